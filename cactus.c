@@ -6,24 +6,46 @@
 #define _GNU_SOURCE
 
 #include <ctype.h>
+#include <dirent.h>
+#include <dlfcn.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <regex.h>
+#include <linux/perf_event.h>
+#include <signal.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdarg.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/time.h>
 #include <sys/types.h>
+#include <sys/wait.h>
 #include <termios.h> // turn off echoing
 #include <time.h>
+#include <ucontext.h>
 #include <unistd.h> // need for input
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 
 /*** defines ***/
 
 #define CACTUS_VERSION "0.0.1"
+
 #define CACTUS_TAB_STOP 8
 #define CACTUS_QUIT_TIMES 3
+#define RX_MARK_STRIDE 256 // chars between cached render positions of long rows
 
 #define CTRL_KEY(k) ((k) & 0x1f)
 
@@ -37,7 +59,11 @@ enum editorKey {
     HOME_KEY,
     END_KEY,
     PAGE_UP,
-    PAGE_DOWN
+    PAGE_DOWN,
+    CTRL_ARROW_LEFT,
+    CTRL_ARROW_RIGHT,
+    IDLE_KEY, // passed to prompt callbacks that have work left while no key is pending
+    TERMINAL_REPLY // the terminal answered a device attributes request
 };
 
 // enum containing possible values that hl can contain
@@ -54,9 +80,47 @@ enum editorHighlight {
 
 #define HL_HIGHLIGHT_NUMBERS (1<<0)
 #define HL_HIGHLIGHT_STRINGS (1<<1)
+#define HL_RAW_STRINGS (1<<2) // c++ R"delim(...)delim"
+#define HL_PREPROCESSOR (1<<3) // #if 0 blocks are comments
+#define HL_CONTINUATIONS (1<<4) // a backslash at the end of a row continues strings and comments
+#define HL_TRIPLE_QUOTES (1<<5) // python's multiline strings
+#define HL_USER_TYPES (1<<6) // typedefs, struct tags and macros are highlighted as types
+#define HL_BRACE_INDENT (1<<7) // indent by the nesting depth of braces
+
+// lexer state carried from the end of one row into the next (erow.hl_state), 0 for none.
+// the low bits say what is still open, a continued string keeps its quote, a raw string
+// the length and a hash of its delimiter, and the top byte counts nested #if 0 blocks.
+// a row that ends in a string it never closed has nothing open, only LEX_UNCLOSED set
+enum lexKind {
+    LEX_NONE = 0,
+    LEX_COMMENT, // multiline comment
+    LEX_LINE_COMMENT, // single line comment continued with a backslash
+    LEX_STRING, // string continued with a backslash, or a triple quoted one
+    LEX_RAW_STRING
+};
+
+#define LEX_KIND(s) ((s) & 0x7)
+#define LEX_QUOTE(s) (((s) >> 3) & 0xff)
+#define LEX_TRIPLE (1u << 11)
+#define LEX_UNCLOSED (1u << 3) // with LEX_NONE
+#define LEX_DELIM_LEN(s) (((s) >> 3) & 0x1f)
+#define LEX_DELIM_HASH(s) (((s) >> 8) & 0xffff)
+#define LEX_IF0_DEPTH(s) ((s) >> 24)
+#define LEX_MAX_DELIM 16
+
+#define SYNTAX_CACHE_MAGIC "CACSYN04"
+#define SYNTAX_FILE_SUFFIX ".syntax"
 
 /*** data ***/
 
+// one slot of an open addressing hash table inside a compiled syntax table.
+// off is a byte offset of the key text from the start of the table, 0 marks an empty slot
+struct tableSlot {
+    uint32_t off;
+    uint16_t len;
+    uint16_t value; // highlight class for keywords, HLDB index for file matches
+};
+
 struct editorSyntax {
     char *filetype;
     char **filematch;
@@ -65,17 +129,87 @@ struct editorSyntax {
     char *multiline_comment_start;
     char *multiline_comment_end;
     int flags;
+    // compiled keyword hash table, filled in by syntaxAttach()
+    const char *table;
+    const struct tableSlot *keywordSlots;
+    uint32_t keywordMask;
+};
+
+// every known syntax, compiled into one relocatable table that is either
+// mmap'd from the on-disk cache or built on the heap at startup
+struct syntaxDB {
+    struct editorSyntax *entries;
+    unsigned int numEntries;
+    const char *table;
+    size_t size;
+    int mapped;
+    const struct tableSlot *matchSlots; // extensions, file names and "!interpreter" shebangs
+    uint32_t matchMask;
+};
+
+enum editorTokenKind {
+    TOK_IDENT = 0,
+    TOK_KEYWORD,
+    TOK_TYPE,
+    TOK_NUMBER,
+    TOK_STRING,
+    TOK_COMMENT,
+    TOK_BRACKET
+};
+
+// a token of a row's render text, kept so word motions, bracket matching etc.
+// don't have to lex the row again
+struct erowToken {
+    int start;
+    int len;
+    unsigned char kind;
+};
+
+// a misspelled word in a row's render text
+struct spellSpan {
+    int start;
+    int len;
+};
+
+// immutable, reference counted block of text. rows borrow their chars from it
+// (a whole file after loading, or what was copied) until they're edited
+struct etext {
+    int refs;
+    size_t len;
+    void *mapBase; // mapping the block lives in when it was restored from a session, else NULL
+    size_t mapLen;
+    char data[];
 };
 
 // editor row
 typedef struct erow {
-    int idx;
     int size;
     int rsize; // render size
-    char *chars;
+    int cap, rcap, hlcap; // bytes allocated for chars, render and hl
+    struct etext *text; // block chars is borrowed from, NULL when the row owns chars
+    char *chars; // only NUL terminated when owned
     char *render;
     unsigned char *hl; // array for highlighting each line in an array
-    int hl_open_comment;
+    uint32_t hl_state; // lexer state at the end of the row, see enum lexKind
+    struct erowToken *tokens; // tokens of render, rebuilt by editorUpdateSyntax
+    int numTokens;
+    int tokenCap;
+    int tokensValid;
+    int plain; // render is printable ascii only, so it can be drawn in runs
+    int *defs; // symbols the row defines
+    int numDefs, defCap;
+    uint64_t identSig; // bit (hash & 63) of every identifier used
+    uint32_t symGen; // SY.generation the highlighting is known to be current at
+    int indentWidth; // leading spaces of render
+    int braceDelta; // opening minus closing braces outside comments and strings
+    int leadingClosers; // closing braces before anything else on the row
+    uint32_t lineHash; // of chars, for diffing against the git index
+    int lineHashValid;
+    int statBytes, statWords, statChars; // newline included, if statsValid
+    int statsValid;
+    int *rxMarks; // rx at every RX_MARK_STRIDE chars, the first numRxMarks are valid
+    int numRxMarks, rxMarkCap;
+    int edited; // changed since the file was opened or saved
 } erow;
 
 // contain editor state
@@ -88,16 +222,28 @@ struct editorConfig {
     int screenCols;
     int numRows;
     erow *row; // an array of erow structs to store multiple lines
+    int rowCap; // number of erows allocated
     int dirty; // marker for bugger if it has been modified since opening or saving the file.
     char *filename; // filename for status bar
     char statusmsg[80];
     time_t statusmsg_time;
     struct editorSyntax *syntax; // pointer to the current editorsyntax struct
+    uint64_t hlCacheHash; // content hash of the last opened or saved version of the file
+    int64_t diskSize, diskMtime; // of that version, mtime in ns, to tell if the file changed since
+    int markSet, markX, markY; // selection runs from the mark to the cursor
     struct termios orig_termios; // original terminal attributes
 };
 
 struct editorConfig E;
 
+struct benchState {
+    int running; // headless --bench run, no terminal and no ~/.cactus
+    int out; // the real stdout, frames are drawn to /dev/null
+    int failed;
+};
+
+struct benchState B;
+
 /*** filetypes ***/
 
 char *C_HL_extensions[] = { ".c", ".h", ".cpp", NULL };
@@ -116,23 +262,618 @@ struct editorSyntax HLDB[] = {
         C_HL_extensions,
         C_HL_keywords,
         "//", "/*", "*/",
-        HL_HIGHLIGHT_NUMBERS | HL_HIGHLIGHT_STRINGS
+        HL_HIGHLIGHT_NUMBERS | HL_HIGHLIGHT_STRINGS | HL_RAW_STRINGS | HL_PREPROCESSOR | HL_CONTINUATIONS |
+        HL_USER_TYPES | HL_BRACE_INDENT,
+        NULL, NULL, 0
     },
 };
 
 #define HLDB_ENTRIES (sizeof(HLDB) / sizeof(HLDB[0]))
 
+struct syntaxDB SDB;
+
 /*** prototypes ***/
 
 void editorSetStatusMessage(const char *fmt, ...);
 
+void die(const char *s);
+
 // implicit declaration of function 'ioctl' is invalid in C99
 int ioctl(int fd, unsigned long request, ...);
 
 void editorRefreshScreen();
 
-char *editorPrompt(char *prompt, void (*callback)(char *, int));
+char *editorPrompt(char *prompt, int (*callback)(char *, int));
+
+int editorDataPath(char *buf, size_t size, const char *name);
+
+int editorRowIndex(erow *row);
+
+void braceInvalidate(int row);
+
+void statsInsertRows(int at, int n);
+
+void statsDeleteRows(int at, int n);
+
+void editorRowStats(erow *row);
+
+void editorRowBraces(erow *row);
+
+void rulerInsertRows(int at, int n);
+
+void rulerDeleteRows(int at, int n);
+
+void spellRowChanged(erow *row);
+
+void spellRowsMoved(int at, int n);
+
+int gutterWidth();
+
+void rulerLexChanged(erow *row, uint32_t old);
+
+void rulerMarkEdited(erow *row);
+
+void rulerSaved();
+
+void editorAutoIndent();
+
+void editorIdle();
+
+void gutterReload();
+
+int jobShowingOutput();
+
+
+/*** instrumentation ***/
+
+// malloc, calloc and realloc are defined here in front of libc's, so every allocation
+// of the process is counted for --bench, the ones libc makes for cactus (strdup, fopen,
+// regcomp) included. the real ones are looked up with dlsym, which may allocate before
+// it has found them: those calls are served from a small arena that is never freed.
+// address sanitizer brings its own allocator and runs before its shadow memory is set
+// up, so nothing is counted under it
+
+#define ALLOC_ARENA_SIZE 4096
+#define ALLOC_ALIGN 16
+
+unsigned long allocCalls;
+
+#ifndef __SANITIZE_ADDRESS__
+struct allocState {
+    void *(*malloc)(size_t);
+    void *(*calloc)(size_t, size_t);
+    void *(*realloc)(void *, size_t);
+    void (*free)(void *);
+    int resolving;
+    union {
+        long double align; // as aligned as malloc's
+        char bytes[ALLOC_ARENA_SIZE];
+    } arena;
+    size_t arenaUsed;
+};
+
+struct allocState AL;
+
+void allocResolve() {
+    AL.resolving = 1;
+    *(void **)&AL.malloc = dlsym(RTLD_NEXT, "malloc");
+    *(void **)&AL.calloc = dlsym(RTLD_NEXT, "calloc");
+    *(void **)&AL.realloc = dlsym(RTLD_NEXT, "realloc");
+    *(void **)&AL.free = dlsym(RTLD_NEXT, "free");
+    AL.resolving = 0;
+    if(!AL.malloc || !AL.calloc || !AL.realloc || !AL.free) abort();
+}
+
+// zeroed memory from the arena, each block is preceded by its size
+void *allocArena(size_t n) {
+    size_t need = ALLOC_ALIGN + (n + ALLOC_ALIGN - 1) / ALLOC_ALIGN * ALLOC_ALIGN;
+    if(n > ALLOC_ARENA_SIZE || need > ALLOC_ARENA_SIZE - AL.arenaUsed) return NULL;
+    char *p = AL.arena.bytes + AL.arenaUsed;
+    AL.arenaUsed += need;
+    memcpy(p, &n, sizeof(n));
+    return p + ALLOC_ALIGN;
+}
+
+int allocInArena(void *p) {
+    return (char *)p >= AL.arena.bytes && (char *)p < AL.arena.bytes + ALLOC_ARENA_SIZE;
+}
+
+void *malloc(size_t n) {
+    allocCalls++;
+    if(!AL.malloc) {
+        if(AL.resolving) return allocArena(n);
+        allocResolve();
+    }
+    return AL.malloc(n);
+}
+
+void *calloc(size_t n, size_t size) {
+    allocCalls++;
+    if(!AL.calloc) {
+        if(AL.resolving) return size && n > ALLOC_ARENA_SIZE / size ? NULL : allocArena(n * size);
+        allocResolve();
+    }
+    return AL.calloc(n, size);
+}
+
+void *realloc(void *p, size_t n) {
+    allocCalls++;
+    if(!AL.realloc) {
+        if(AL.resolving) return NULL;
+        allocResolve();
+    }
+    if(!allocInArena(p)) return AL.realloc(p, n);
+    size_t old;
+    memcpy(&old, (char *)p - ALLOC_ALIGN, sizeof(old));
+    void *q = AL.malloc(n);
+    if(q) memcpy(q, p, old < n ? old : n);
+    return q;
+}
+
+void free(void *p) {
+    if(!p || allocInArena(p)) return;
+    if(!AL.free) allocResolve();
+    AL.free(p);
+}
+#endif
+
+// with --perf-counters, hardware counters are read at the entry and exit of the
+// regions below and the difference is charged to the innermost open region.
+// --watchdog times the same regions for every key-to-frame cycle
+
+enum perfRegion {
+    PERF_OTHER = 0, // anything outside an instrumented region
+    PERF_SYNTAX,
+    PERF_ROW_UPDATE,
+    PERF_DRAW,
+    PERF_SEARCH,
+    PERF_IO,
+    PERF_REGIONS
+};
+
+enum perfCounter {
+    PERF_TASK_CLOCK = 0, // software counter, leads the group since it always exists
+    PERF_CYCLES,
+    PERF_INSTRUCTIONS,
+    PERF_L1D_MISSES,
+    PERF_LLC_MISSES,
+    PERF_BRANCH_MISSES,
+    PERF_COUNTERS
+};
+
+#define PERF_MAX_DEPTH 16
+
+struct perfState {
+    int enabled; // some region accounting below is on
+    int counting; // hardware counters are open
+    int leader; // group leader fd, the whole group is read at once
+    int slot[PERF_COUNTERS]; // position of each counter in a group read, -1 if unavailable
+    int numCounters;
+    uint64_t last[PERF_COUNTERS];
+    uint64_t total[PERF_REGIONS][PERF_COUNTERS];
+    uint64_t calls[PERF_REGIONS];
+    int stack[PERF_MAX_DEPTH];
+    int depth;
+    uint64_t lastNs;
+    uint64_t frameNs[PERF_REGIONS]; // time per region since the last key arrived
+    int cascade; // rows re-highlighted because the row before them changed state
+};
+
+struct perfState P;
+
+#define WATCHDOG_DEFAULT_MS 50
+
+struct watchdogState {
+    int thresholdMs; // 0 when the watchdog is off
+    char path[1024];
+    int key; // key being handled, -1 once its frame has been checked
+    uint64_t keyNs; // when its first byte arrived
+};
+
+struct watchdogState W;
+
+uint64_t monotonicNs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+const char *perfRegionNames[PERF_REGIONS] = {
+    "other", "syntax", "row update", "draw", "search", "i/o"
+};
+
+const char *perfCounterNames[PERF_COUNTERS] = {
+    "task clock", "cycles", "instructions", "l1d misses", "llc misses", "branch misses"
+};
+
+int perfOpenCounter(uint32_t type, uint64_t config, int group) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.disabled = (group == -1);
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_GROUP;
+    return syscall(SYS_perf_event_open, &attr, 0, -1, group, 0);
+}
+
+// read the counters and charge what happened since the last read to the current region
+void perfCharge() {
+    int depth = P.depth > PERF_MAX_DEPTH ? PERF_MAX_DEPTH : P.depth;
+    int region = depth ? P.stack[depth - 1] : PERF_OTHER;
+
+    if(W.thresholdMs) {
+        uint64_t now = monotonicNs();
+        P.frameNs[region] += now - P.lastNs;
+        P.lastNs = now;
+    }
+    if(!P.counting) return;
+
+    uint64_t buf[1 + PERF_COUNTERS];
+    if(read(P.leader, buf, sizeof(buf)) < (ssize_t)(sizeof(uint64_t) * (1 + P.numCounters))) return;
+    for(int c = 0; c < PERF_COUNTERS; c++) {
+        if(P.slot[c] == -1) continue;
+        uint64_t now = buf[1 + P.slot[c]];
+        P.total[region][c] += now - P.last[c];
+        P.last[c] = now;
+    }
+}
+
+void perfBegin(int region) {
+    if(!P.enabled) return;
+    perfCharge();
+    // nesting deeper than the stack (e.g. the syntax cascade) keeps charging the deepest region
+    if(P.depth < PERF_MAX_DEPTH) P.stack[P.depth] = region;
+    P.depth++;
+    P.calls[region]++;
+}
+
+void perfEnd() {
+    if(!P.enabled) return;
+    perfCharge();
+    P.depth--;
+}
+
+void perfReport() {
+    perfCharge();
+    fprintf(stderr, "%-12s %10s %10s %14s %14s %6s %12s %12s %12s\r\n", "region", "calls",
+        "cpu ms", "cycles", "instructions", "ipc", "l1d misses", "llc misses", "br misses");
+    for(int r = 0; r < PERF_REGIONS; r++) {
+        uint64_t *t = P.total[r];
+        double ipc = t[PERF_CYCLES] ? (double)t[PERF_INSTRUCTIONS] / t[PERF_CYCLES] : 0;
+        fprintf(stderr, "%-12s %10llu %10.1f %14llu %14llu %6.2f %12llu %12llu %12llu\r\n",
+            perfRegionNames[r], (unsigned long long)P.calls[r], t[PERF_TASK_CLOCK] / 1e6,
+            (unsigned long long)t[PERF_CYCLES], (unsigned long long)t[PERF_INSTRUCTIONS], ipc,
+            (unsigned long long)t[PERF_L1D_MISSES], (unsigned long long)t[PERF_LLC_MISSES],
+            (unsigned long long)t[PERF_BRANCH_MISSES]);
+    }
+    for(int c = 0; c < PERF_COUNTERS; c++) {
+        if(P.slot[c] == -1) fprintf(stderr, "(%s not supported on this machine)\r\n", perfCounterNames[c]);
+    }
+}
+
+void perfInit() {
+    static const struct { uint32_t type; uint64_t config; } counters[PERF_COUNTERS] = {
+        { PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK },
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+        { PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+            (PERF_COUNT_HW_CACHE_RESULT_MISS << 16) },
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+    };
+
+    P.leader = perfOpenCounter(counters[0].type, counters[0].config, -1);
+    if(P.leader == -1) {
+        perror("perf_event_open");
+        exit(1);
+    }
+    P.slot[0] = 0;
+    P.numCounters = 1;
+    for(int c = 1; c < PERF_COUNTERS; c++) {
+        // not every cpu (or vm) has every counter, keep going without the missing ones
+        int fd = perfOpenCounter(counters[c].type, counters[c].config, P.leader);
+        P.slot[c] = fd == -1 ? -1 : P.numCounters++;
+    }
+
+    ioctl(P.leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    P.enabled = 1;
+    P.counting = 1;
+    perfCharge();
+    // registered before raw mode is enabled, so it prints after the terminal is restored
+    atexit(perfReport);
+}
+
+// a key arrived, start timing its frame
+void watchdogKeyArrived() {
+    if(!W.thresholdMs) return;
+    memset(P.frameNs, 0, sizeof(P.frameNs));
+    P.cascade = 0;
+    W.keyNs = P.lastNs = monotonicNs();
+}
+
+void watchdogKeyName(int key, char *buf, size_t size) {
+    static const char *names[] = {
+        "left", "right", "up", "down", "del", "home", "end", "page-up", "page-down",
+        "ctrl-left", "ctrl-right"
+    };
+    if(key >= ARROW_LEFT && key < ARROW_LEFT + (int)(sizeof(names) / sizeof(names[0])))
+        snprintf(buf, size, "%s", names[key - ARROW_LEFT]);
+    else if(key == BACKSPACE) snprintf(buf, size, "backspace");
+    else if(key == '\x1b') snprintf(buf, size, "esc");
+    else if(key == '\r') snprintf(buf, size, "enter");
+    else if(key < 32) snprintf(buf, size, "ctrl-%c", key + '@');
+    else if(key == ' ') snprintf(buf, size, "space");
+    else snprintf(buf, size, "%c", key);
+}
+
+// a frame was drawn, log the key that led to it if it took too long
+void watchdogFrameDone() {
+    if(!W.thresholdMs || W.key == -1) return;
+    perfCharge();
+    uint64_t total = P.lastNs - W.keyNs;
+    int key = W.key;
+    W.key = -1;
+    if(total < (uint64_t)W.thresholdMs * 1000000) return;
+
+    long long bytes = 0;
+    for(int j = 0; j < E.numRows; j++) bytes += E.row[j].size + 1;
+
+    char name[16], stamp[32], line[512];
+    time_t now = time(NULL);
+    watchdogKeyName(key, name, sizeof(name));
+    strftime(stamp, sizeof(stamp), "%Y-%m-%dT%H:%M:%S", localtime(&now));
+    int len = snprintf(line, sizeof(line), "%s slow frame: key=%s total=%.1fms", stamp, name, total / 1e6);
+    for(int r = 0; r < PERF_REGIONS; r++) {
+        len += snprintf(line + len, sizeof(line) - len, " %s=%.1fms",
+            perfRegionNames[r], P.frameNs[r] / 1e6);
+    }
+    len += snprintf(line + len, sizeof(line) - len,
+        " file=%s rows=%d bytes=%lld row=%d rowlen=%d cascade=%d\n",
+        E.filename ? E.filename : "[No Name]", E.numRows, bytes, E.cy,
+        E.cy < E.numRows ? E.row[E.cy].size : 0, P.cascade);
+    if(len >= (int)sizeof(line)) len = sizeof(line) - 1;
+
+    int fd = open(W.path, O_WRONLY | O_APPEND | O_CREAT, 0644);
+    if(fd == -1) return;
+    write(fd, line, len);
+    close(fd);
+}
+
+void watchdogInit(int thresholdMs) {
+    char *env = getenv("CACTUS_DIAG_LOG");
+    if(env) snprintf(W.path, sizeof(W.path), "%s", env);
+    else if(editorDataPath(W.path, sizeof(W.path), "diagnostics.log") == -1) die("watchdog: no HOME");
+    W.thresholdMs = thresholdMs > 0 ? thresholdMs : WATCHDOG_DEFAULT_MS;
+    W.key = -1;
+    P.enabled = 1;
+    P.lastNs = monotonicNs();
+}
+
+// with --latency, a frame drawn for a key ends with a device attributes request (DA1).
+// the terminal answers it only after everything before it is processed, so the time from
+// the key being read to the reply being read covers drawing, the terminal and whatever is
+// in between, like tmux or ssh. keys handled before the same frame share one probe,
+// timed from the first of them
+
+#define LATENCY_MAX_PENDING 64
+#define LATENCY_DRAIN_MS 200
+
+struct latencyState {
+    int enabled;
+    const char *path; // every sample in ns is written here on exit, NULL for none
+    uint64_t readNs; // when the first byte of the last key or reply was read
+    uint64_t keyNs; // first key a probe hasn't been sent for yet, 0 if none
+    uint64_t pending[LATENCY_MAX_PENDING]; // keys of the probes in flight, oldest at head
+    int head, numPending;
+    uint64_t *samples;
+    int numSamples, sampleCap;
+    int held, heldKey; // a key editorKeyPending read while taking replies off the input
+};
+
+struct latencyState LT;
+
+void latencyRead() {
+    if(LT.enabled) LT.readNs = monotonicNs();
+}
+
+// what was read was a key
+void latencyKey() {
+    if(LT.enabled && !LT.keyNs) LT.keyNs = LT.readNs;
+}
+
+// a frame is about to be written, returns 1 if it should end with a probe.
+// a terminal that doesn't answer stops being asked once LATENCY_MAX_PENDING are in flight
+int latencyProbe() {
+    if(!LT.enabled || !LT.keyNs || LT.numPending == LATENCY_MAX_PENDING) return 0;
+    LT.pending[(LT.head + LT.numPending++) % LATENCY_MAX_PENDING] = LT.keyNs;
+    LT.keyNs = 0;
+    return 1;
+}
+
+// the terminal answered the oldest probe
+void latencyReply() {
+    if(!LT.numPending) return;
+    uint64_t ns = LT.readNs - LT.pending[LT.head];
+    LT.head = (LT.head + 1) % LATENCY_MAX_PENDING;
+    LT.numPending--;
+    if(LT.numSamples == LT.sampleCap) {
+        LT.sampleCap = LT.sampleCap ? LT.sampleCap * 2 : 1024;
+        LT.samples = realloc(LT.samples, sizeof(uint64_t) * LT.sampleCap);
+    }
+    LT.samples[LT.numSamples++] = ns;
+}
+
+int latencyCompare(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+void latencyReport() {
+    int n = LT.numSamples;
+    if(LT.path) {
+        FILE *fp = fopen(LT.path, "w");
+        if(fp) {
+            for(int i = 0; i < n; i++) fprintf(fp, "%llu\n", (unsigned long long)LT.samples[i]);
+            fclose(fp);
+        } else {
+            perror(LT.path);
+        }
+    }
+    if(n == 0) {
+        fprintf(stderr, "no latency samples, the terminal didn't answer\r\n");
+        return;
+    }
+
+    qsort(LT.samples, n, sizeof(uint64_t), latencyCompare);
+    static const double percentiles[] = { 50, 90, 99, 99.9 };
+    fprintf(stderr, "%8s %10s", "keys", "min ms");
+    for(int i = 0; i < 4; i++) {
+        char label[24];
+        snprintf(label, sizeof(label), "p%g ms", percentiles[i]);
+        fprintf(stderr, " %10s", label);
+    }
+    fprintf(stderr, " %10s\r\n%8d %10.2f", "max ms", n, LT.samples[0] / 1e6);
+    for(int i = 0; i < 4; i++) fprintf(stderr, " %10.2f", LT.samples[(int)((n - 1) * percentiles[i] / 100)] / 1e6);
+    fprintf(stderr, " %10.2f\r\n", LT.samples[n - 1] / 1e6);
+}
+
+void latencyInit(const char *path) {
+    LT.enabled = 1;
+    LT.path = path;
+    atexit(latencyReport);
+}
+
+// with --profile, SIGPROF fires every PROF_INTERVAL_US of cpu time and the handler
+// walks the frame pointer chain of the interrupted code into a preallocated ring.
+// the stacks are symbolized and written out as folded stacks (for flamegraph.pl) on exit
+
+#define PROF_INTERVAL_US 1000
+#define PROF_MAX_SAMPLES 32768
+#define PROF_MAX_FRAMES 24
+
+struct profSample {
+    int depth;
+    uintptr_t pc[PROF_MAX_FRAMES]; // innermost frame first
+};
+
+struct profState {
+    const char *path;
+    struct profSample *samples;
+    volatile unsigned long numSamples; // total taken, the ring keeps the last PROF_MAX_SAMPLES
+};
+
+struct profState PR;
+
+void profHandler(int sig, siginfo_t *info, void *ctx) {
+    (void)sig;
+    (void)info;
+    ucontext_t *uc = ctx;
+    uintptr_t pc, fp, sp;
+#if defined(__x86_64__)
+    pc = uc->uc_mcontext.gregs[REG_RIP];
+    fp = uc->uc_mcontext.gregs[REG_RBP];
+    sp = uc->uc_mcontext.gregs[REG_RSP];
+#elif defined(__aarch64__)
+    pc = uc->uc_mcontext.pc;
+    fp = uc->uc_mcontext.regs[29];
+    sp = uc->uc_mcontext.sp;
+#else
+    (void)uc;
+    return;
+#endif
+
+    // the gutter worker and --replace's writer can take SIGPROF at the same time as the main
+    // thread, so the slot is claimed before it's filled
+    unsigned long slot = __atomic_fetch_add(&PR.numSamples, 1, __ATOMIC_RELAXED);
+    struct profSample *s = &PR.samples[slot % PROF_MAX_SAMPLES];
+    int depth = 0;
+    s->pc[depth++] = pc;
+    // each frame starts with the caller's frame pointer followed by the return address.
+    // only follow pointers that move up the stack so a bad chain can't send us astray
+    while(depth < PROF_MAX_FRAMES && fp >= sp && fp - sp < (8 << 20) &&
+        (fp & (sizeof(uintptr_t) - 1)) == 0) {
+        uintptr_t *frame = (uintptr_t *)fp;
+        if(frame[1] == 0) break;
+        s->pc[depth++] = frame[1];
+        if(frame[0] <= fp) break;
+        fp = frame[0];
+    }
+    s->depth = depth;
+}
+
+void profFrameName(uintptr_t pc, char *buf, size_t size) {
+    Dl_info info;
+    if(dladdr((void *)pc, &info) && info.dli_sname) snprintf(buf, size, "%s", info.dli_sname);
+    else snprintf(buf, size, "0x%lx", (unsigned long)pc);
+}
+
+int profCompare(const void *a, const void *b) {
+    return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+void profWrite() {
+    struct itimerval stop;
+    memset(&stop, 0, sizeof(stop));
+    setitimer(ITIMER_PROF, &stop, NULL);
+    signal(SIGPROF, SIG_IGN);
+
+    FILE *fp = fopen(PR.path, "w");
+    if(!fp) {
+        perror(PR.path);
+        return;
+    }
+
+    // one "root;...;leaf" line per sample, sorted so identical stacks can be counted
+    unsigned long n = PR.numSamples < PROF_MAX_SAMPLES ? PR.numSamples : PROF_MAX_SAMPLES;
+    char **lines = malloc(sizeof(char *) * (n ? n : 1));
+    for(unsigned long i = 0; i < n; i++) {
+        struct profSample *s = &PR.samples[i];
+        char line[PROF_MAX_FRAMES * 64];
+        int len = 0;
+        for(int d = s->depth - 1; d >= 0; d--) {
+            char name[64];
+            // return addresses point past the call, step back into the calling function
+            profFrameName(d == 0 ? s->pc[d] : s->pc[d] - 1, name, sizeof(name));
+            len += snprintf(line + len, sizeof(line) - len, "%s%s", name, d ? ";" : "");
+        }
+        lines[i] = strdup(line);
+    }
+    qsort(lines, n, sizeof(char *), profCompare);
+
+    for(unsigned long i = 0; i < n;) {
+        unsigned long j = i;
+        while(j < n && !strcmp(lines[j], lines[i])) j++;
+        fprintf(fp, "%s %lu\n", lines[i], j - i);
+        i = j;
+    }
+    for(unsigned long i = 0; i < n; i++) free(lines[i]);
+    free(lines);
+    fclose(fp);
+    fprintf(stderr, "wrote %lu samples to %s\r\n", n, PR.path);
+}
 
+void profInit(const char *path) {
+    PR.path = path;
+    PR.samples = calloc(PROF_MAX_SAMPLES, sizeof(struct profSample));
+    if(PR.samples == NULL) die("calloc");
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_sigaction = profHandler;
+    sa.sa_flags = SA_SIGINFO | SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    if(sigaction(SIGPROF, &sa, NULL) == -1) die("sigaction");
+
+    struct itimerval timer;
+    timer.it_interval.tv_sec = 0;
+    timer.it_interval.tv_usec = PROF_INTERVAL_US;
+    timer.it_value = timer.it_interval;
+    if(setitimer(ITIMER_PROF, &timer, NULL) == -1) die("setitimer");
+    atexit(profWrite);
+}
 
 /*** terminal ***/
 
@@ -162,7 +903,7 @@ void enableRawMode() {
     // sets the character size (CS) to 8 bits per byte
     raw.c_lflag |= (CS8);
     // disable Ctrl-S/Q and fix Ctrl-M
-    raw.c_lflag &= ~(ICRNL | IXON);
+    raw.c_iflag &= ~(ICRNL | IXON);
 
     // turn off canonical mode and echoing and Ctrl-C/Z/V signals
     // program exits immediately when a q is detected
@@ -181,22 +922,31 @@ void enableRawMode() {
 }
 
 // wait for one keypress and return it
-int editorReadKey() {
+int editorReadKeySequence() {
     int nread;
     char c;
     while ((nread = read(STDIN_FILENO, &c, 1)) != 1) {
         if (nread == -1 && errno != EAGAIN) die("read");
     }
+    watchdogKeyArrived();
+    latencyRead();
 
     // read arrow keys
     if (c == '\x1b') {
-        char seq[3];
+        char seq[5];
 
         if (read(STDIN_FILENO, &seq[0], 1) != 1) return '\x1b';
         if (read(STDIN_FILENO, &seq[1], 1) != 1) return '\x1b';
 
         if (seq[0] == '[') {
-            if(seq[1] >= '0' && seq[1] <= '9') {
+            if(seq[1] == '?') {
+                // "\x1b[?62;22c", skip the parameters up to the final byte
+                char f = 0;
+                for(int i = 0; i < 32 && (f < '@' || f > '~'); i++) {
+                    if(read(STDIN_FILENO, &f, 1) != 1) return '\x1b';
+                }
+                return f == 'c' ? TERMINAL_REPLY : '\x1b';
+            } else if(seq[1] >= '0' && seq[1] <= '9') {
                 if(read(STDIN_FILENO, &seq[2], 1) != 1) return '\x1b';
                 if(seq[2] == '~') {
                     switch(seq[1]) {
@@ -208,6 +958,16 @@ int editorReadKey() {
                         case '7': return HOME_KEY;
                         case '8': return END_KEY;
                     }
+                } else if(seq[2] == ';') {
+                    // modified keys, "\x1b[1;5C" is ctrl + right arrow
+                    if(read(STDIN_FILENO, &seq[3], 1) != 1) return '\x1b';
+                    if(read(STDIN_FILENO, &seq[4], 1) != 1) return '\x1b';
+                    if(seq[3] == '5') {
+                        switch(seq[4]) {
+                            case 'C': return CTRL_ARROW_RIGHT;
+                            case 'D': return CTRL_ARROW_LEFT;
+                        }
+                    }
                 }
             } else {
                 // return corresponding wasd character for arrow key escape sequence
@@ -233,6 +993,58 @@ int editorReadKey() {
     }
 }
 
+int editorReadKey() {
+    int key;
+    if(LT.held) {
+        key = LT.heldKey;
+        LT.held = 0;
+    } else {
+        // background work runs until a key comes, answers to --latency probes aren't keys
+        editorIdle();
+        while((key = editorReadKeySequence()) == TERMINAL_REPLY) {
+            latencyReply();
+            editorIdle();
+        }
+    }
+    latencyKey();
+    W.key = key;
+    return key;
+}
+
+// check for input without blocking. with --latency, answers to probes are taken off the
+// input here so they don't stop work that runs until a key is pressed
+int editorKeyPending() {
+    struct pollfd pfd;
+    pfd.fd = STDIN_FILENO;
+    pfd.events = POLLIN;
+    if(LT.held) return 1;
+    while(poll(&pfd, 1, 0) > 0) {
+        if(!LT.enabled) return 1;
+        int key = editorReadKeySequence();
+        if(key != TERMINAL_REPLY) {
+            LT.held = 1;
+            LT.heldKey = key;
+            return 1;
+        }
+        latencyReply();
+    }
+    return 0;
+}
+
+// on quit, wait a little for the answers still in flight so the terminal doesn't
+// type them into the shell once raw mode is off
+void latencyDrain() {
+    struct pollfd pfd;
+    pfd.fd = STDIN_FILENO;
+    pfd.events = POLLIN;
+    uint64_t end = monotonicNs() + LATENCY_DRAIN_MS * 1000000ULL;
+    while(LT.enabled && LT.numPending) {
+        uint64_t now = monotonicNs();
+        if(now >= end || poll(&pfd, 1, (int)((end - now) / 1000000) + 1) <= 0) break;
+        if(editorReadKeySequence() == TERMINAL_REPLY) latencyReply();
+    }
+}
+
 // ioctl() isn't guaranteed to be able to request the window size on all system
 // so fallback method of getting window size
 int getCursorPosition(int *rows, int *cols) {
@@ -268,84 +1080,857 @@ int getWindowSize(int *rows, int *cols) {
     }
 }
 
-/*** syntax highlighting ***/
+/*** syntax database ***/
+
+// layout of a compiled syntax table: header, entries, file match slots,
+// the keyword slots of every entry, then a pool of NUL terminated strings.
+// everything is addressed by offsets so the table can be used straight out of an mmap
+struct syntaxTableHeader {
+    char magic[8];
+    uint64_t fingerprint; // hash of the definitions the table was compiled from
+    uint32_t size;
+    uint32_t numEntries;
+    uint32_t matchOff;
+    uint32_t matchMask;
+};
 
-int is_seperator(int c) {
-    // take a character and return true if it's a seperator character
-    return isspace(c) || c == '\0' || strchr(",.()+-/*=~%<>[];", c) != NULL;
+struct syntaxTableEntry {
+    uint32_t filetype;
+    uint32_t scs, mcs, mce; // comment delimiters, 0 if the language has none
+    uint32_t flags;
+    uint32_t keywordOff;
+    uint32_t keywordMask;
+};
+
+// a syntax definition as parsed from a .syntax file or converted from HLDB
+struct syntaxDef {
+    char *filetype;
+    char *scs, *mcs, *mce;
+    int flags;
+    char **match; // ".ext", file name or "!interpreter"
+    int numMatch;
+    char **keywords; // common types carry a trailing '|' like in HLDB
+    int numKeywords;
+};
+
+// FNV-1a, used for every hash table in the compiled syntax table
+uint32_t hashBytes(const char *s, int len) {
+    uint32_t h = 2166136261u;
+    for(int i = 0; i < len; i++) {
+        h ^= (unsigned char)s[i];
+        h *= 16777619u;
+    }
+    return h;
 }
 
-void editorUpdateSyntax(erow *row) {
-    row->hl = realloc(row->hl, row->rsize);
-    // set all characters to HL_NORMAL by default
-    memset(row->hl, HL_NORMAL, row->rsize);
+uint64_t hashBytes64(uint64_t h, const void *p, size_t len) {
+    const unsigned char *s = p;
+    for(size_t i = 0; i < len; i++) {
+        h ^= s[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
 
-    if (E.syntax == NULL) return;
+// look up len bytes of s in a compiled hash table, returns the slot value or -1
+int tableLookup(const char *table, const struct tableSlot *slots, uint32_t mask,
+    const char *s, int len) {
+    uint32_t i = hashBytes(s, len) & mask;
+    while(slots[i].off) {
+        if(slots[i].len == len && !memcmp(table + slots[i].off, s, len))
+            return slots[i].value;
+        i = (i + 1) & mask;
+    }
+    return -1;
+}
 
-    char **keywords = E.syntax->keywords;
+// a hash table read from a file stays inside it: every key is in bounds, every value is
+// at most maxValue and an empty slot ends every probe
+int tableSlotsValid(const char *table, size_t size, uint32_t off, uint32_t mask, uint32_t maxValue) {
+    if(off % sizeof(uint32_t) || (mask & (mask + 1)) || off + ((size_t)mask + 1) * sizeof(struct tableSlot) > size) return 0;
+    const struct tableSlot *slots = (const struct tableSlot *)(table + off);
+    int empty = 0;
+    for(uint32_t i = 0; i <= mask; i++) {
+        if(!slots[i].off) empty = 1;
+        else if(slots[i].off > size || slots[i].len > size - slots[i].off || slots[i].value > maxValue) return 0;
+    }
+    return empty;
+}
 
-    char *scs = E.syntax->singleline_comment_start;
-    char *mcs = E.syntax->multiline_comment_start;
-    char *mce = E.syntax->multiline_comment_end;
+// a string in a table read from a file is NUL terminated inside it, 0 is no string
+int tableStringValid(const char *table, size_t size, uint32_t off) {
+    return off == 0 || (off < size && memchr(table + off, '\0', size - off));
+}
 
-    int scs_len = scs ? strlen(scs) : 0;
-    int mcs_len = mcs ? strlen(mcs) : 0;
-    int mce_len = mce ? strlen(mce) : 0;
+void tableInsert(char *table, struct tableSlot *slots, uint32_t mask,
+    uint32_t off, int len, int value) {
+    uint32_t i = hashBytes(table + off, len) & mask;
+    while(slots[i].off) {
+        // the first definition of a key wins
+        if(slots[i].len == len && !memcmp(table + slots[i].off, table + off, len)) return;
+        i = (i + 1) & mask;
+    }
+    slots[i].off = off;
+    slots[i].len = len;
+    slots[i].value = value;
+}
 
-    int prevSep = 1; // keep track if the previous character is a seperator
-    int in_string = 0; // keep track of whether we are currently inside a string
-    // keep track of whether we are currently inside a multilen comment
-    int in_comment = (row->idx > 0 && E.row[row->idx - 1].hl_open_comment);
+// keep hash tables at most half full
+uint32_t tableSlotCount(int keys) {
+    uint32_t n = 8;
+    while(n < (uint32_t)keys * 2) n <<= 1;
+    return n;
+}
 
-    int i = 0;
-    while (i < row->rsize) {
-        char c = row->render[i];
-        unsigned char prev_hl = (i > 0) ? row->hl[i - 1] : HL_NORMAL;
+uint32_t tableAddString(char *table, uint32_t *pool, const char *s) {
+    if(s == NULL) return 0;
+    uint32_t off = *pool;
+    size_t len = strlen(s);
+    memcpy(table + off, s, len + 1);
+    *pool += len + 1;
+    return off;
+}
 
-        if(scs_len && !in_string && !in_comment) {
-            if(!strncmp(&row->render[i], scs, scs_len)) {
-                memset(&row->hl[i], HL_COMMENT, row->rsize - i);
-                break;
-            }
-        }
+void syntaxDefAdd(char ***list, int *n, const char *s) {
+    *list = realloc(*list, sizeof(char *) * (*n + 1));
+    (*list)[(*n)++] = strdup(s);
+}
 
-        if(mcs_len && mce_len && !in_string) {
-            if(in_comment) {
-                row->hl[i] = HL_MULTI_LINE_COMMENT;
-                if(!strncmp(&row->render[i], mce, mce_len)) {
-                    memset(&row->hl[i], HL_MULTI_LINE_COMMENT, mce_len);
-                    i += mce_len;
-                    in_comment = 0;
-                    prevSep = 1;
-                    continue;
-                } else {
-                    i++;
-                    continue;
-                }
-            } else if(!strncmp(&row->render[i], mcs, mcs_len)) {
-                memset(&row->hl[i], HL_MULTI_LINE_COMMENT, mcs_len);
-                i += mcs_len;
-                in_comment = 1;
-                continue;
+void syntaxDefFree(struct syntaxDef *def) {
+    int i;
+    for(i = 0; i < def->numMatch; i++) free(def->match[i]);
+    for(i = 0; i < def->numKeywords; i++) free(def->keywords[i]);
+    free(def->match);
+    free(def->keywords);
+    free(def->filetype);
+    free(def->scs);
+    free(def->mcs);
+    free(def->mce);
+}
+
+// parse a definition file made of "directive value..." lines, see syntax/*.syntax
+int syntaxParseFile(const char *path, struct syntaxDef *def) {
+    FILE *fp = fopen(path, "r");
+    if(!fp) return -1;
+
+    memset(def, 0, sizeof(*def));
+    char *line = NULL;
+    size_t linecap = 0;
+    while(getline(&line, &linecap, fp) != -1) {
+        char *save;
+        char *key = strtok_r(line, " \t\r\n", &save);
+        if(key == NULL || key[0] == '#') continue;
+
+        char *arg;
+        while((arg = strtok_r(NULL, " \t\r\n", &save)) != NULL) {
+            if(!strcmp(key, "filetype")) {
+                free(def->filetype);
+                def->filetype = strdup(arg);
+            } else if(!strcmp(key, "extensions") || !strcmp(key, "filenames")) {
+                syntaxDefAdd(&def->match, &def->numMatch, arg);
+            } else if(!strcmp(key, "shebang")) {
+                char name[64];
+                snprintf(name, sizeof(name), "!%s", arg);
+                syntaxDefAdd(&def->match, &def->numMatch, name);
+            } else if(!strcmp(key, "keywords")) {
+                syntaxDefAdd(&def->keywords, &def->numKeywords, arg);
+            } else if(!strcmp(key, "types")) {
+                char name[64];
+                snprintf(name, sizeof(name), "%s|", arg);
+                syntaxDefAdd(&def->keywords, &def->numKeywords, name);
+            } else if(!strcmp(key, "comment")) {
+                free(def->scs);
+                def->scs = strdup(arg);
+            } else if(!strcmp(key, "multiline_comment")) {
+                if(def->mcs == NULL) def->mcs = strdup(arg);
+                else if(def->mce == NULL) def->mce = strdup(arg);
+            } else if(!strcmp(key, "flags")) {
+                if(!strcmp(arg, "numbers")) def->flags |= HL_HIGHLIGHT_NUMBERS;
+                if(!strcmp(arg, "strings")) def->flags |= HL_HIGHLIGHT_STRINGS;
+                if(!strcmp(arg, "raw_strings")) def->flags |= HL_RAW_STRINGS;
+                if(!strcmp(arg, "preprocessor")) def->flags |= HL_PREPROCESSOR;
+                if(!strcmp(arg, "continuations")) def->flags |= HL_CONTINUATIONS;
+                if(!strcmp(arg, "triple_quotes")) def->flags |= HL_TRIPLE_QUOTES;
+                if(!strcmp(arg, "user_types")) def->flags |= HL_USER_TYPES;
+                if(!strcmp(arg, "brace_indent")) def->flags |= HL_BRACE_INDENT;
             }
         }
+    }
+    free(line);
+    fclose(fp);
 
-        if(E.syntax->flags & HL_HIGHLIGHT_STRINGS) {
-            if(in_string) {
-                row->hl[i] = HL_STRING;
-                if(c == '\\' && i + 1 < row->rsize) {
-                    row->hl[i + 1] = HL_STRING;
-                    i += 2;
+    if(def->filetype == NULL) {
+        syntaxDefFree(def);
+        return -1;
+    }
+    return 0;
+}
+
+int syntaxIsDefFile(const char *name) {
+    size_t len = strlen(name), slen = strlen(SYNTAX_FILE_SUFFIX);
+    return name[0] != '.' && len > slen && !strcmp(name + len - slen, SYNTAX_FILE_SUFFIX);
+}
+
+// hash of everything the compiled table is built from, so a stale cache is never used
+uint64_t syntaxFingerprint(const char *dir) {
+    uint64_t h = hashBytes64(14695981039346656037ULL, SYNTAX_CACHE_MAGIC, 8);
+    h = hashBytes64(h, dir, strlen(dir));
+
+    for(unsigned int j = 0; j < HLDB_ENTRIES; j++) {
+        struct editorSyntax *s = &HLDB[j];
+        h = hashBytes64(h, s->filetype, strlen(s->filetype));
+        for(int i = 0; s->filematch[i]; i++) h = hashBytes64(h, s->filematch[i], strlen(s->filematch[i]) + 1);
+        for(int i = 0; s->keywords[i]; i++) h = hashBytes64(h, s->keywords[i], strlen(s->keywords[i]) + 1);
+        h = hashBytes64(h, &s->flags, sizeof(s->flags));
+    }
+
+    // directory order is unspecified, so combine the files order independently
+    uint64_t files = 0;
+    DIR *d = opendir(dir);
+    if(d) {
+        struct dirent *ent;
+        while((ent = readdir(d)) != NULL) {
+            if(!syntaxIsDefFile(ent->d_name)) continue;
+            char path[1024];
+            struct stat st;
+            snprintf(path, sizeof(path), "%s/%s", dir, ent->d_name);
+            if(stat(path, &st) == -1) continue;
+            uint64_t f = hashBytes64(14695981039346656037ULL, ent->d_name, strlen(ent->d_name));
+            f = hashBytes64(f, &st.st_size, sizeof(st.st_size));
+            f = hashBytes64(f, &st.st_mtime, sizeof(st.st_mtime));
+            files += f;
+        }
+        closedir(d);
+    }
+    return hashBytes64(h, &files, sizeof(files));
+}
+
+// collect the definition files in dir followed by the built-in HLDB entries
+int syntaxLoadDefs(const char *dir, struct syntaxDef **defs) {
+    int n = 0;
+    *defs = NULL;
+
+    DIR *d = opendir(dir);
+    if(d) {
+        struct dirent *ent;
+        while((ent = readdir(d)) != NULL) {
+            if(!syntaxIsDefFile(ent->d_name)) continue;
+            char path[1024];
+            snprintf(path, sizeof(path), "%s/%s", dir, ent->d_name);
+            *defs = realloc(*defs, sizeof(struct syntaxDef) * (n + 1));
+            if(syntaxParseFile(path, &(*defs)[n]) == 0) n++;
+        }
+        closedir(d);
+    }
+
+    for(unsigned int j = 0; j < HLDB_ENTRIES; j++) {
+        struct editorSyntax *s = &HLDB[j];
+        *defs = realloc(*defs, sizeof(struct syntaxDef) * (n + 1));
+        struct syntaxDef *def = &(*defs)[n++];
+        memset(def, 0, sizeof(*def));
+        def->filetype = strdup(s->filetype);
+        def->scs = s->singleline_comment_start ? strdup(s->singleline_comment_start) : NULL;
+        def->mcs = s->multiline_comment_start ? strdup(s->multiline_comment_start) : NULL;
+        def->mce = s->multiline_comment_end ? strdup(s->multiline_comment_end) : NULL;
+        def->flags = s->flags;
+        for(int i = 0; s->filematch[i]; i++) syntaxDefAdd(&def->match, &def->numMatch, s->filematch[i]);
+        for(int i = 0; s->keywords[i]; i++) syntaxDefAdd(&def->keywords, &def->numKeywords, s->keywords[i]);
+    }
+    return n;
+}
+
+// compile definitions into a single table that can be used in place once mmap'd
+char *syntaxCompile(struct syntaxDef *defs, int numDefs, uint64_t fingerprint, size_t *size) {
+    int numMatch = 0;
+    size_t poolLen = 0;
+    int i, j;
+    for(i = 0; i < numDefs; i++) {
+        struct syntaxDef *def = &defs[i];
+        numMatch += def->numMatch;
+        poolLen += strlen(def->filetype) + 1;
+        if(def->scs) poolLen += strlen(def->scs) + 1;
+        if(def->mcs) poolLen += strlen(def->mcs) + 1;
+        if(def->mce) poolLen += strlen(def->mce) + 1;
+        for(j = 0; j < def->numMatch; j++) poolLen += strlen(def->match[j]) + 1;
+        for(j = 0; j < def->numKeywords; j++) poolLen += strlen(def->keywords[j]) + 1;
+    }
+
+    uint32_t matchSlots = tableSlotCount(numMatch);
+    uint32_t off = sizeof(struct syntaxTableHeader) + numDefs * sizeof(struct syntaxTableEntry);
+    uint32_t matchOff = off;
+    off += matchSlots * sizeof(struct tableSlot);
+    uint32_t keywordStart = off;
+    for(i = 0; i < numDefs; i++) off += tableSlotCount(defs[i].numKeywords) * sizeof(struct tableSlot);
+    uint32_t pool = off;
+
+    *size = pool + poolLen;
+    char *table = calloc(1, *size);
+
+    struct syntaxTableHeader *h = (struct syntaxTableHeader *)table;
+    memcpy(h->magic, SYNTAX_CACHE_MAGIC, 8);
+    h->fingerprint = fingerprint;
+    h->size = *size;
+    h->numEntries = numDefs;
+    h->matchOff = matchOff;
+    h->matchMask = matchSlots - 1;
+
+    struct syntaxTableEntry *entries = (struct syntaxTableEntry *)(table + sizeof(*h));
+    struct tableSlot *match = (struct tableSlot *)(table + matchOff);
+    off = keywordStart;
+    for(i = 0; i < numDefs; i++) {
+        struct syntaxDef *def = &defs[i];
+        struct syntaxTableEntry *e = &entries[i];
+        uint32_t keywordSlots = tableSlotCount(def->numKeywords);
+
+        e->filetype = tableAddString(table, &pool, def->filetype);
+        e->scs = tableAddString(table, &pool, def->scs);
+        e->mcs = tableAddString(table, &pool, def->mcs);
+        e->mce = tableAddString(table, &pool, def->mce);
+        e->flags = def->flags;
+        e->keywordOff = off;
+        e->keywordMask = keywordSlots - 1;
+
+        for(j = 0; j < def->numMatch; j++) {
+            uint32_t s = tableAddString(table, &pool, def->match[j]);
+            tableInsert(table, match, h->matchMask, s, strlen(def->match[j]), i);
+        }
+
+        struct tableSlot *keywords = (struct tableSlot *)(table + off);
+        for(j = 0; j < def->numKeywords; j++) {
+            int kLen = strlen(def->keywords[j]);
+            int common_types = def->keywords[j][kLen - 1] == '|';
+            if(common_types) kLen--;
+            uint32_t s = tableAddString(table, &pool, def->keywords[j]);
+            tableInsert(table, keywords, e->keywordMask, s, kLen,
+                common_types ? HL_COMMON_TYPES : HL_KEYWORDS);
+        }
+        off += keywordSlots * sizeof(struct tableSlot);
+    }
+    return table;
+}
+
+// point SDB at a compiled table, returns -1 if the table is malformed
+int syntaxAttach(const char *table, size_t size, int mapped) {
+    const struct syntaxTableHeader *h = (const struct syntaxTableHeader *)table;
+    if(size < sizeof(*h) || memcmp(h->magic, SYNTAX_CACHE_MAGIC, 8) || h->size != size) return -1;
+    if(sizeof(*h) + (size_t)h->numEntries * sizeof(struct syntaxTableEntry) > size) return -1;
+    if(h->numEntries == 0 || !tableSlotsValid(table, size, h->matchOff, h->matchMask, h->numEntries - 1)) return -1;
+
+    const struct syntaxTableEntry *entries = (const struct syntaxTableEntry *)(table + sizeof(*h));
+    struct editorSyntax *syntax = calloc(h->numEntries, sizeof(struct editorSyntax));
+    for(unsigned int i = 0; i < h->numEntries; i++) {
+        const struct syntaxTableEntry *e = &entries[i];
+        if(!tableSlotsValid(table, size, e->keywordOff, e->keywordMask, HL_COMMON_TYPES) ||
+            e->filetype == 0 || !tableStringValid(table, size, e->filetype) || !tableStringValid(table, size, e->scs) ||
+            !tableStringValid(table, size, e->mcs) || !tableStringValid(table, size, e->mce)) {
+            free(syntax);
+            return -1;
+        }
+        syntax[i].filetype = (char *)table + e->filetype;
+        syntax[i].singleline_comment_start = e->scs ? (char *)table + e->scs : NULL;
+        syntax[i].multiline_comment_start = e->mcs ? (char *)table + e->mcs : NULL;
+        syntax[i].multiline_comment_end = e->mce ? (char *)table + e->mce : NULL;
+        syntax[i].flags = e->flags;
+        syntax[i].table = table;
+        syntax[i].keywordSlots = (const struct tableSlot *)(table + e->keywordOff);
+        syntax[i].keywordMask = e->keywordMask;
+    }
+
+    SDB.entries = syntax;
+    SDB.numEntries = h->numEntries;
+    SDB.table = table;
+    SDB.size = size;
+    SDB.mapped = mapped;
+    SDB.matchSlots = (const struct tableSlot *)(table + h->matchOff);
+    SDB.matchMask = h->matchMask;
+    return 0;
+}
+
+void syntaxWriteCache(const char *path, const char *table, size_t size) {
+    char tmp[1024];
+    snprintf(tmp, sizeof(tmp), "%s.%d", path, (int)getpid());
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if(fd == -1) return;
+    int ok = write(fd, table, size) == (ssize_t)size;
+    close(fd);
+    // rename so a concurrently starting editor never maps a half written cache
+    if(!ok || rename(tmp, path) == -1) unlink(tmp);
+}
+
+// load every syntax definition, from the compiled cache if it is still valid
+void editorLoadSyntaxDB() {
+    char dir[1024], cache[1024];
+    char *env = getenv("CACTUS_SYNTAX_DIR");
+    if(env) snprintf(dir, sizeof(dir), "%s", env);
+    else if(editorDataPath(dir, sizeof(dir), "syntax") == -1) dir[0] = '\0';
+    if(editorDataPath(cache, sizeof(cache), "syntax.cache") == -1) cache[0] = '\0';
+
+    uint64_t fingerprint = syntaxFingerprint(dir);
+
+    int fd = cache[0] ? open(cache, O_RDONLY) : -1;
+    if(fd != -1) {
+        struct stat st;
+        if(fstat(fd, &st) == 0 && st.st_size >= (off_t)sizeof(struct syntaxTableHeader)) {
+            char *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if(map != MAP_FAILED) {
+                if(((struct syntaxTableHeader *)map)->fingerprint == fingerprint &&
+                    syntaxAttach(map, st.st_size, 1) == 0) {
+                    close(fd);
+                    return;
+                }
+                munmap(map, st.st_size);
+            }
+        }
+        close(fd);
+    }
+
+    // no usable cache, compile the definitions and refresh it
+    struct syntaxDef *defs;
+    int numDefs = syntaxLoadDefs(dir, &defs);
+    size_t size;
+    char *table = syntaxCompile(defs, numDefs, fingerprint, &size);
+    for(int i = 0; i < numDefs; i++) syntaxDefFree(&defs[i]);
+    free(defs);
+
+    if(cache[0]) syntaxWriteCache(cache, table, size);
+    if(syntaxAttach(table, size, 0) == -1) die("syntaxAttach");
+}
+
+int syntaxMatch(const char *s, int len) {
+    return tableLookup(SDB.table, SDB.matchSlots, SDB.matchMask, s, len);
+}
+
+// find the syntax for a "#!/usr/bin/env python3" style first line
+int syntaxMatchShebang(erow *row) {
+    if(row->size < 3 || strncmp(row->chars, "#!", 2)) return -1;
+
+    char *p = row->chars + 2;
+    char *end = row->chars + row->size;
+    char key[64];
+    int len = 0;
+    // take the base name of the interpreter, skipping env and its options
+    while(p < end) {
+        while(p < end && isspace((unsigned char)*p)) p++;
+        char *name = p;
+        while(p < end && !isspace((unsigned char)*p)) {
+            if(*p == '/') name = p + 1;
+            p++;
+        }
+        if(name == p || *name == '-') continue;
+        if(p - name == 3 && !strncmp(name, "env", 3)) continue;
+
+        len = snprintf(key, sizeof(key), "!%.*s", (int)(p - name), name);
+        if(len >= (int)sizeof(key)) len = sizeof(key) - 1;
+        break;
+    }
+    if(len == 0) return -1;
+
+    int entry = syntaxMatch(key, len);
+    // "python3.11" falls back to "python"
+    while(entry == -1 && len > 1 && (isdigit((unsigned char)key[len - 1]) || key[len - 1] == '.')) {
+        len--;
+        if(!isdigit((unsigned char)key[len - 1]) && key[len - 1] != '.')
+            entry = syntaxMatch(key, len);
+    }
+    return entry;
+}
+
+/*** symbols ***/
+
+// typedef names, struct/union/enum tags and macros defined in the buffer, counted by
+// the rows defining them. rows keep a 64 bit signature of the identifiers they use,
+// so a symbol appearing or going away only marks the rows that may use it as stale
+
+#define SYMBOL_MAX_ROW_DEFS 8
+
+struct symbol {
+    char *name;
+    int len;
+    int refs; // rows defining it
+    int next; // next symbol in the bucket or the free list, -1 at the end
+    uint32_t hash;
+};
+
+struct symbolTable {
+    struct symbol *sym;
+    int numSyms, symCap;
+    int freeList;
+    int *bucket;
+    int numBuckets; // power of two
+    int count;
+    int bulk; // rows are highlighted in bulk, stale rows are marked at the end
+    uint64_t bulkBits; // signature bits of the symbols that changed meanwhile
+    uint32_t generation; // bumped every time symbols change
+    uint32_t bitGen[64]; // generation each signature bit last changed at
+};
+
+struct symbolTable SY = { .freeList = -1 };
+
+uint64_t symbolBit(uint32_t hash) {
+    return 1ULL << (hash & 63);
+}
+
+// rows aren't visited, a row is found stale when it's next used by editorRowStale
+void symbolMarkStale(uint64_t bits) {
+    SY.generation++;
+    for(int b = 0; b < 64; b++) {
+        if(bits >> b & 1) SY.bitGen[b] = SY.generation;
+    }
+}
+
+// a symbol the row may use changed since it was highlighted. a row that turns out
+// current is stamped so it isn't checked bit by bit again
+int editorRowStale(erow *row) {
+    if(row->symGen == SY.generation) return 0;
+    for(int b = 0; b < 64; b++) {
+        if((row->identSig >> b & 1) && SY.bitGen[b] > row->symGen) return 1;
+    }
+    row->symGen = SY.generation;
+    return 0;
+}
+
+void symbolChanged(uint32_t hash) {
+    if(SY.bulk) SY.bulkBits |= symbolBit(hash);
+    else symbolMarkStale(symbolBit(hash));
+}
+
+void symbolBulkBegin() {
+    SY.bulk = 1;
+    SY.bulkBits = 0;
+}
+
+// mark - whether rows using the symbols that changed should be re-highlighted
+void symbolBulkEnd(int mark) {
+    SY.bulk = 0;
+    if(mark && SY.bulkBits) symbolMarkStale(SY.bulkBits);
+}
+
+int symbolFind(const char *s, int len) {
+    if(SY.count == 0) return -1;
+    uint32_t hash = hashBytes(s, len);
+    for(int id = SY.bucket[hash & (SY.numBuckets - 1)]; id != -1; id = SY.sym[id].next) {
+        struct symbol *sym = &SY.sym[id];
+        if(sym->hash == hash && sym->len == len && !memcmp(sym->name, s, len)) return id;
+    }
+    return -1;
+}
+
+void symbolRehash(int numBuckets) {
+    SY.bucket = realloc(SY.bucket, sizeof(int) * numBuckets);
+    SY.numBuckets = numBuckets;
+    for(int b = 0; b < numBuckets; b++) SY.bucket[b] = -1;
+    for(int id = 0; id < SY.numSyms; id++) {
+        if(SY.sym[id].refs == 0) continue;
+        int b = SY.sym[id].hash & (numBuckets - 1);
+        SY.sym[id].next = SY.bucket[b];
+        SY.bucket[b] = id;
+    }
+}
+
+// add a defining row to a symbol, creating it if needed
+int symbolRef(const char *s, int len) {
+    int id = symbolFind(s, len);
+    if(id != -1) {
+        SY.sym[id].refs++;
+        return id;
+    }
+
+    if(SY.count >= SY.numBuckets) symbolRehash(SY.numBuckets ? SY.numBuckets * 2 : 256);
+    if(SY.freeList != -1) {
+        id = SY.freeList;
+        SY.freeList = SY.sym[id].next;
+    } else {
+        if(SY.numSyms == SY.symCap) {
+            SY.symCap = SY.symCap ? SY.symCap * 2 : 64;
+            SY.sym = realloc(SY.sym, sizeof(struct symbol) * SY.symCap);
+        }
+        id = SY.numSyms++;
+    }
+    struct symbol *sym = &SY.sym[id];
+    sym->name = malloc(len);
+    memcpy(sym->name, s, len);
+    sym->len = len;
+    sym->refs = 1;
+    sym->hash = hashBytes(s, len);
+
+    int b = sym->hash & (SY.numBuckets - 1);
+    sym->next = SY.bucket[b];
+    SY.bucket[b] = id;
+    SY.count++;
+    symbolChanged(sym->hash);
+    return id;
+}
+
+void symbolUnref(int id) {
+    struct symbol *sym = &SY.sym[id];
+    if(--sym->refs > 0) return;
+
+    int *link = &SY.bucket[sym->hash & (SY.numBuckets - 1)];
+    while(*link != id) link = &SY.sym[*link].next;
+    *link = sym->next;
+    free(sym->name);
+    sym->name = NULL;
+    sym->next = SY.freeList;
+    SY.freeList = id;
+    SY.count--;
+    symbolChanged(sym->hash);
+}
+
+/*** syntax highlighting ***/
+
+// make room for need bytes, growing by half again so that a row edited one
+// character at a time doesn't reallocate on every keystroke
+void *editorReserve(void *p, int *cap, int need) {
+    if(need <= *cap) return p;
+    int newCap = *cap + *cap / 2;
+    if(newCap < need) newCap = need;
+    p = realloc(p, newCap);
+    if(p == NULL) die("realloc");
+    *cap = newCap;
+    return p;
+}
+
+int is_seperator(int c) {
+    // take a character and return true if it's a seperator character
+    return isspace(c) || c == '\0' || strchr(",.()+-/*=~%<>[];", c) != NULL;
+}
+
+int is_ident_char(int c) {
+    return isalnum(c) || c == '_';
+}
+
+void editorRowAddToken(erow *row, int start, int len, int kind) {
+    if(row->numTokens == row->tokenCap) {
+        row->tokenCap = row->tokenCap ? row->tokenCap * 2 : 8;
+        row->tokens = realloc(row->tokens, sizeof(struct erowToken) * row->tokenCap);
+    }
+    struct erowToken *t = &row->tokens[row->numTokens++];
+    t->start = start;
+    t->len = len;
+    t->kind = kind;
+}
+
+// add an identifier token if an identifier starts at render index i
+void editorRowAddIdent(erow *row, int i) {
+    if(!(isalpha((unsigned char)row->render[i]) || row->render[i] == '_')) return;
+    if(i > 0 && is_ident_char((unsigned char)row->render[i - 1])) return;
+    int len = 1;
+    while(i + len < row->rsize && is_ident_char((unsigned char)row->render[i + len])) len++;
+    editorRowAddToken(row, i, len, TOK_IDENT);
+}
+
+int editorSetLexState(erow *row, uint32_t state) {
+    uint32_t old = row->hl_state;
+    row->hl_state = state;
+    if(old != state) rulerLexChanged(row, old);
+    return old != state;
+}
+
+// the directive of a preprocessor row ("if", "endif", ...), NULL if it isn't one
+char *lexDirective(erow *row, int *len) {
+    int i = 0;
+    while(i < row->rsize && isspace((unsigned char)row->render[i])) i++;
+    if(i == row->rsize || row->render[i] != '#') return NULL;
+    i++;
+    while(i < row->rsize && isspace((unsigned char)row->render[i])) i++;
+    int start = i;
+    while(i < row->rsize && isalpha((unsigned char)row->render[i])) i++;
+    *len = i - start;
+    return &row->render[start];
+}
+
+int lexWordIs(const char *w, int len, const char *word) {
+    return w && len == (int)strlen(word) && !strncmp(w, word, len);
+}
+
+uint32_t lexDelimHash(const char *s, int len) {
+    return hashBytes(s, len) & 0xffff;
+}
+
+// lex one row starting from the state the previous row ended in,
+// returns 1 if the state it ends in changed so the next row needs it too
+int editorLexRow(erow *row) {
+    if(!row->hlcap) row->hl = NULL; // borrowed from a session snapshot
+    row->hl = editorReserve(row->hl, &row->hlcap, row->rsize);
+    // set all characters to HL_NORMAL by default
+    if(row->rsize) memset(row->hl, HL_NORMAL, row->rsize);
+    spellRowChanged(row);
+    row->numTokens = 0;
+    row->tokensValid = 1;
+
+    if (E.syntax == NULL) {
+        // no syntax, still split the row into words and brackets
+        for(int i = 0; i < row->rsize; i++) {
+            if(row->render[i] && strchr("()[]{}", row->render[i])) editorRowAddToken(row, i, 1, TOK_BRACKET);
+            else editorRowAddIdent(row, i);
+        }
+        return editorSetLexState(row, 0);
+    }
+
+    char *scs = E.syntax->singleline_comment_start;
+    char *mcs = E.syntax->multiline_comment_start;
+    char *mce = E.syntax->multiline_comment_end;
+
+    int scs_len = scs ? strlen(scs) : 0;
+    int mcs_len = mcs ? strlen(mcs) : 0;
+    int mce_len = mce ? strlen(mce) : 0;
+
+    int flags = E.syntax->flags;
+    int at = editorRowIndex(row);
+    uint32_t start = at > 0 ? E.row[at - 1].hl_state : 0;
+    int depth = LEX_IF0_DEPTH(start); // #if 0 blocks we are in
+    int openIf0 = 0; // the row starts a #if 0 block
+
+    if((flags & HL_PREPROCESSOR) && (depth || LEX_KIND(start) == LEX_NONE)) {
+        int wLen;
+        char *w = lexDirective(row, &wLen);
+        if(depth) {
+            if(lexWordIs(w, wLen, "if") || lexWordIs(w, wLen, "ifdef") || lexWordIs(w, wLen, "ifndef")) depth++;
+            else if(lexWordIs(w, wLen, "endif")) depth--;
+            else if(depth == 1 && (lexWordIs(w, wLen, "else") || lexWordIs(w, wLen, "elif"))) depth = 0;
+            if(depth) {
+                // compiled out, nothing to lex
+                if(row->rsize) {
+                    memset(row->hl, HL_MULTI_LINE_COMMENT, row->rsize);
+                    editorRowAddToken(row, 0, row->rsize, TOK_COMMENT);
+                }
+                return editorSetLexState(row, (uint32_t)depth << 24);
+            }
+            start = 0;
+        } else if(lexWordIs(w, wLen, "if")) {
+            char *p = w + wLen, *end = row->render + row->rsize;
+            while(p < end && isspace((unsigned char)*p)) p++;
+            openIf0 = p < end && *p == '0' && (p + 1 == end || isspace((unsigned char)p[1]) || p[1] == '/');
+        }
+    }
+
+    if(LEX_KIND(start) == LEX_LINE_COMMENT) {
+        if(row->rsize) {
+            memset(row->hl, HL_COMMENT, row->rsize);
+            editorRowAddToken(row, 0, row->rsize, TOK_COMMENT);
+        }
+        int more = row->rsize && row->render[row->rsize - 1] == '\\';
+        return editorSetLexState(row, more ? LEX_LINE_COMMENT : LEX_NONE);
+    }
+
+    int prevSep = 1; // keep track if the previous character is a seperator
+    int in_string = 0; // keep track of whether we are currently inside a string
+    int triple = 0; // the string is triple quoted
+    int rawLen = -1, rawHash = 0; // delimiter of the raw string we are in
+    int continued = 0; // the string is continued on the next row
+    int lineComment = 0; // the single line comment is continued on the next row
+    // keep track of whether we are currently inside a multilen comment
+    int in_comment = LEX_KIND(start) == LEX_COMMENT;
+    if(LEX_KIND(start) == LEX_STRING) {
+        in_string = LEX_QUOTE(start);
+        triple = (start & LEX_TRIPLE) != 0;
+    } else if(LEX_KIND(start) == LEX_RAW_STRING) {
+        in_string = '"';
+        rawLen = LEX_DELIM_LEN(start);
+        rawHash = LEX_DELIM_HASH(start);
+    }
+    int tokenStart = 0; // where the string or comment we are in started
+
+    int i = 0;
+    while (i < row->rsize) {
+        char c = row->render[i];
+        unsigned char prev_hl = (i > 0) ? row->hl[i - 1] : HL_NORMAL;
+
+        if(scs_len && !in_string && !in_comment) {
+            if(!strncmp(&row->render[i], scs, scs_len)) {
+                memset(&row->hl[i], HL_COMMENT, row->rsize - i);
+                editorRowAddToken(row, i, row->rsize - i, TOK_COMMENT);
+                lineComment = (flags & HL_CONTINUATIONS) && row->render[row->rsize - 1] == '\\';
+                break;
+            }
+        }
+
+        if(mcs_len && mce_len && !in_string) {
+            if(in_comment) {
+                row->hl[i] = HL_MULTI_LINE_COMMENT;
+                if(!strncmp(&row->render[i], mce, mce_len)) {
+                    memset(&row->hl[i], HL_MULTI_LINE_COMMENT, mce_len);
+                    i += mce_len;
+                    in_comment = 0;
+                    prevSep = 1;
+                    editorRowAddToken(row, tokenStart, i - tokenStart, TOK_COMMENT);
+                    continue;
+                } else {
+                    i++;
+                    continue;
+                }
+            } else if(!strncmp(&row->render[i], mcs, mcs_len)) {
+                memset(&row->hl[i], HL_MULTI_LINE_COMMENT, mcs_len);
+                tokenStart = i;
+                i += mcs_len;
+                in_comment = 1;
+                continue;
+            }
+        }
+
+        if(E.syntax->flags & HL_HIGHLIGHT_STRINGS) {
+            if(in_string) {
+                row->hl[i] = HL_STRING;
+                if(rawLen >= 0) {
+                    // raw strings have no escapes and end at )delim"
+                    if(c == ')' && i + rawLen + 1 < row->rsize && row->render[i + rawLen + 1] == '"' &&
+                        (int)lexDelimHash(&row->render[i + 1], rawLen) == rawHash) {
+                        memset(&row->hl[i], HL_STRING, rawLen + 2);
+                        i += rawLen + 2;
+                        in_string = 0;
+                        rawLen = -1;
+                        editorRowAddToken(row, tokenStart, i - tokenStart, TOK_STRING);
+                    } else {
+                        i++;
+                    }
+                    prevSep = 1;
+                    continue;
+                }
+                if(c == '\\' && i + 1 < row->rsize) {
+                    row->hl[i + 1] = HL_STRING;
+                    i += 2;
                     continue;
                 }
-                if(c == in_string) in_string = 0;
+                if(c == '\\') continued = (flags & HL_CONTINUATIONS) != 0;
+                if(c == in_string && (!triple || (i + 2 < row->rsize &&
+                    row->render[i + 1] == c && row->render[i + 2] == c))) {
+                    if(triple) {
+                        memset(&row->hl[i], HL_STRING, 3);
+                        i += 2;
+                    }
+                    in_string = 0;
+                    triple = 0;
+                    editorRowAddToken(row, tokenStart, i + 1 - tokenStart, TOK_STRING);
+                }
                 i++;
                 prevSep = 1;
                 continue;
             } else {
                 if(c == '"' || c == '\'') {
                     in_string = c;
+                    tokenStart = i;
                     row->hl[i] = HL_STRING;
+                    if((flags & HL_TRIPLE_QUOTES) && i + 2 < row->rsize &&
+                        row->render[i + 1] == c && row->render[i + 2] == c) {
+                        memset(&row->hl[i], HL_STRING, 3);
+                        triple = 1;
+                        i += 3;
+                        continue;
+                    }
+                    if((flags & HL_RAW_STRINGS) && c == '"' && i > 0 && row->render[i - 1] == 'R' &&
+                        (i == 1 || is_seperator(row->render[i - 2]) || strchr("8uUL", row->render[i - 2]))) {
+                        // R"delim( with a delimiter of up to 16 characters
+                        int d = 0;
+                        while(d <= LEX_MAX_DELIM && i + 1 + d < row->rsize &&
+                            !strchr("()\\ \"", row->render[i + 1 + d])) d++;
+                        if(d <= LEX_MAX_DELIM && i + 1 + d < row->rsize && row->render[i + 1 + d] == '(') {
+                            rawLen = d;
+                            rawHash = lexDelimHash(&row->render[i + 1], d);
+                            memset(&row->hl[i], HL_STRING, d + 2);
+                            i += d + 2;
+                            continue;
+                        }
+                    }
                     i++;
                     continue;
                 }
@@ -356,6 +1941,10 @@ void editorUpdateSyntax(erow *row) {
             if ((isdigit(c) && (prevSep || prev_hl == HL_NUMBER)) ||
             (c == '.' && prev_hl == HL_NUMBER)) {
                 row->hl[i] = HL_NUMBER;
+                // digits of the same number extend its token
+                struct erowToken *last = row->numTokens ? &row->tokens[row->numTokens - 1] : NULL;
+                if(last && last->kind == TOK_NUMBER && last->start + last->len == i) last->len++;
+                else editorRowAddToken(row, i, 1, TOK_NUMBER);
                 i++;
                 prevSep = 0;
                 continue;
@@ -363,34 +1952,147 @@ void editorUpdateSyntax(erow *row) {
         }
 
         if(prevSep) {
-            int j;
-            for(j = 0; keywords[j]; j++) {
-                int kLen = strlen(keywords[j]);
-                int common_types = keywords[j][kLen - 1] == '|';
-                if(common_types) kLen--;
-
-                if(!strncmp(&row->render[i], keywords[j], kLen) &&
-                    is_seperator(row->render[i + kLen])) {
-                        memset(&row->hl[i], common_types ? HL_COMMON_TYPES : HL_KEYWORDS, kLen);
-                        i += kLen;
-                        break;
-                    }
+            // look the whole word up in the compiled keyword table
+            int kLen = 0;
+            while(i + kLen < row->rsize && !is_seperator(row->render[i + kLen])) kLen++;
+            int kw = kLen ? tableLookup(E.syntax->table, E.syntax->keywordSlots,
+                E.syntax->keywordMask, &row->render[i], kLen) : -1;
+            if(kw == -1 && (flags & HL_USER_TYPES) && SY.count) {
+                kLen = 0;
+                while(i + kLen < row->rsize && is_ident_char((unsigned char)row->render[i + kLen])) kLen++;
+                if(kLen && symbolFind(&row->render[i], kLen) != -1) kw = HL_COMMON_TYPES;
             }
-            if(keywords[j] != NULL) {
+            if(kw != -1) {
+                memset(&row->hl[i], kw, kLen);
+                editorRowAddToken(row, i, kLen, kw == HL_COMMON_TYPES ? TOK_TYPE : TOK_KEYWORD);
+                i += kLen;
                 prevSep = 0;
                 continue;
             }
         }
 
+        if(c && strchr("()[]{}", c)) editorRowAddToken(row, i, 1, TOK_BRACKET);
+        else editorRowAddIdent(row, i);
+
         prevSep = is_seperator(c);
         i++;
     }
+    // strings and comments running past the end of the row
+    if(in_comment) editorRowAddToken(row, tokenStart, row->rsize - tokenStart, TOK_COMMENT);
+    else if(in_string) editorRowAddToken(row, tokenStart, row->rsize - tokenStart, TOK_STRING);
+
+    uint32_t state = LEX_NONE;
+    if(in_comment) state = LEX_COMMENT;
+    else if(lineComment) state = LEX_LINE_COMMENT;
+    else if(in_string && rawLen >= 0) state = LEX_RAW_STRING | (uint32_t)rawLen << 3 | (uint32_t)rawHash << 8;
+    else if(in_string && (triple || continued)) state = LEX_STRING | (uint32_t)in_string << 3 | (triple ? LEX_TRIPLE : 0);
+    else if(in_string) state = LEX_UNCLOSED;
+    state |= (uint32_t)(depth + openIf0) << 24;
+    return editorSetLexState(row, state);
+}
+
+int tokenIs(erow *row, struct erowToken *t, const char *word) {
+    return t->len == (int)strlen(word) && !strncmp(&row->render[t->start], word, t->len);
+}
+
+int tokenIsName(struct erowToken *t) {
+    return t->kind == TOK_IDENT || t->kind == TOK_TYPE;
+}
+
+// next non-space character of the render after `at`, 0 at the end of the row
+char renderNext(erow *row, int at) {
+    while(at < row->rsize && isspace((unsigned char)row->render[at])) at++;
+    return at < row->rsize ? row->render[at] : 0;
+}
+
+// find the symbols a row defines from its tokens and update its signature
+void editorRowSymbols(erow *row) {
+    int found[SYMBOL_MAX_ROW_DEFS];
+    int numFound = 0, k;
+    uint64_t sig = 0;
+    struct erowToken *t = row->tokens;
+    int n = row->numTokens;
+
+    for(k = 0; k < n; k++) {
+        if(tokenIsName(&t[k])) sig |= symbolBit(hashBytes(&row->render[t[k].start], t[k].len));
+    }
+    row->identSig = sig;
+    row->symGen = SY.generation;
+
+    struct erowToken *def[SYMBOL_MAX_ROW_DEFS];
+    int numDef = 0;
+    if(E.syntax && (E.syntax->flags & HL_USER_TYPES) && n > 0) {
+        int wLen;
+        char *w = lexDirective(row, &wLen);
+        if(lexWordIs(w, wLen, "define")) {
+            // #define NAME
+            for(k = 0; k + 1 < n; k++) {
+                if(t[k].kind == TOK_IDENT && tokenIs(row, &t[k], "define")) {
+                    if(tokenIsName(&t[k + 1])) def[numDef++] = &t[k + 1];
+                    break;
+                }
+            }
+        } else if(t[0].kind == TOK_KEYWORD && tokenIs(row, &t[0], "typedef")) {
+            // typedef ... NAME; or typedef ret (*NAME)(...);
+            char *fnPtr = strstr(row->render, "(*");
+            if(fnPtr) {
+                for(k = 1; k < n; k++) {
+                    if(tokenIsName(&t[k]) && t[k].start > fnPtr - row->render) {
+                        def[numDef++] = &t[k];
+                        break;
+                    }
+                }
+            } else {
+                for(k = n - 1; k > 0; k--) {
+                    if(tokenIsName(&t[k]) && renderNext(row, t[k].start + t[k].len) == ';') {
+                        def[numDef++] = &t[k];
+                        break;
+                    }
+                }
+            }
+        } else if(renderNext(row, 0) == '}' && n >= 1 && tokenIsName(&t[n - 1]) &&
+            renderNext(row, t[n - 1].start + t[n - 1].len) == ';' && (n == 1 || t[n - 2].kind == TOK_BRACKET)) {
+            // } NAME; closing a typedef'd struct
+            def[numDef++] = &t[n - 1];
+        }
+        // struct/union/enum NAME { or at the end of the row
+        for(k = 0; k + 1 < n && numDef < SYMBOL_MAX_ROW_DEFS; k++) {
+            if(t[k].kind != TOK_KEYWORD || !tokenIsName(&t[k + 1])) continue;
+            if(!tokenIs(row, &t[k], "struct") && !tokenIs(row, &t[k], "union") && !tokenIs(row, &t[k], "enum")) continue;
+            char next = renderNext(row, t[k + 1].start + t[k + 1].len);
+            if(next == '{' || next == 0) def[numDef++] = &t[k + 1];
+        }
+    }
 
-    int changed = (row->hl_open_comment != in_comment);
-    row->hl_open_comment = in_comment;
-    if(changed && row->idx + 1 < E.numRows) {
-        editorUpdateSyntax(&E.row[row->idx + 1]);
+    // take the new references before dropping the old ones, so unchanged symbols stay put
+    for(k = 0; k < numDef; k++) found[numFound++] = symbolRef(&row->render[def[k]->start], def[k]->len);
+    for(k = 0; k < row->numDefs; k++) symbolUnref(row->defs[k]);
+    if(numFound) {
+        row->defs = editorReserve(row->defs, &row->defCap, sizeof(int) * numFound);
+        memcpy(row->defs, found, sizeof(int) * numFound);
     }
+    row->numDefs = numFound;
+}
+
+int editorHighlightRow(erow *row) {
+    int changed = editorLexRow(row);
+    editorRowSymbols(row);
+    editorRowBraces(row);
+    return changed;
+}
+
+// highlight a row, then the rows after it for as long as the state they start in changes
+void editorUpdateSyntax(erow *row) {
+    perfBegin(PERF_SYNTAX);
+    int at = editorRowIndex(row);
+    while(editorHighlightRow(&E.row[at]) && ++at < E.numRows) P.cascade++;
+    perfEnd();
+}
+
+// tokens of a row, re-lexing it if they were dropped (e.g. highlighting came from the cache)
+struct erowToken *editorRowTokens(erow *row) {
+    if(!row->tokensValid) editorUpdateSyntax(row);
+    return row->tokens;
 }
 
 // map values in hl to actual ANSI color codes we want to draw them with
@@ -407,42 +2109,46 @@ int editorSyntaxToColor(int hl) {
     }
 }
 
-// match current filename to filematch field in HLDB
-void editorSelectSyntaxHighlight() {
-    E.syntax = NULL;
-    if (E.filename == NULL) return;
-
-    char *ext = strrchr(E.filename, '.');
-
-    for(unsigned int j = 0; j < HLDB_ENTRIES; j++) {
-        struct editorSyntax *s = &HLDB[j];
-        unsigned int i = 0;
-        while(s->filematch[i]) {
-            int is_ext = (s->filematch[i][0] == '.');
-            if((is_ext && ext && !strcmp(ext, s->filematch[i])) ||
-                (!is_ext && strstr(E.filename, s->filematch[i]))) {
-                E.syntax = s;
-
-                int fileRow;
-                for(fileRow = 0; fileRow < E.numRows; fileRow++) {
-                    editorUpdateSyntax(&E.row[fileRow]);
-                }
-
-                return;
-            }
-            i++;
+// pick the syntax by extension, file name or shebang line
+struct editorSyntax *editorDetectSyntax() {
+    int entry = -1;
+    if(E.filename) {
+        char *ext = strrchr(E.filename, '.');
+        if(ext) entry = syntaxMatch(ext, strlen(ext));
+        if(entry == -1) {
+            char *base = strrchr(E.filename, '/');
+            base = base ? base + 1 : E.filename;
+            entry = syntaxMatch(base, strlen(base));
         }
     }
+    if(entry == -1 && E.numRows > 0) entry = syntaxMatchShebang(&E.row[0]);
+    return entry == -1 ? NULL : &SDB.entries[entry];
+}
+
+void editorSelectSyntaxHighlight() {
+    E.syntax = editorDetectSyntax();
+    if(E.syntax == NULL) return;
+
+    // rows above a definition are highlighted again when they are drawn
+    symbolBulkBegin();
+    int fileRow;
+    for(fileRow = 0; fileRow < E.numRows; fileRow++) {
+        editorUpdateSyntax(&E.row[fileRow]);
+    }
+    symbolBulkEnd(1);
 }
 
 /*** row operations ***/
 
-// convert a chars index into a render index
-int editorRowCxToRx(erow *row, int cx) {
-    int rx = 0;
-    int j;
+// rows are always in E.row, so where they are is their index
+int editorRowIndex(erow *row) {
+    return row - E.row;
+}
+
+// rx after the chars in [from, to), starting from rx at from
+int editorRowScanRx(erow *row, int from, int to, int rx) {
     // loop through all the characters to the left of cx and figure out how many spaces each tab takes up
-    for(j = 0; j < cx; j++) {
+    for(int j = from; j < to; j++) {
         if(row->chars[j] == '\t') {
             // find how many columns we are to the right of the last tab stop
             // then subtract that from CACTUS_TAB_STOP - 1
@@ -455,342 +2161,3542 @@ int editorRowCxToRx(erow *row, int cx) {
     return rx;
 }
 
-// convert render index to chars index before assigning it
-int editorRowRxToCx(erow *row, int rx) {
-    int cur_rx = 0;
-    int cx;
-    for(cx = 0; cx < row->size; cx++) {
-        if(row->chars[cx] == '\t') {
-            cur_rx += (CACTUS_TAB_STOP - 1) - (cur_rx % CACTUS_TAB_STOP);
+// rx at chars index k * RX_MARK_STRIDE. the marks are built as far as they're asked for and
+// kept until the row changes, so moving along a long tab-heavy row doesn't rescan it each time
+int editorRowRxMark(erow *row, int k) {
+    if(k == 0) return 0;
+    if(k > row->numRxMarks) {
+        row->rxMarks = editorReserve(row->rxMarks, &row->rxMarkCap, sizeof(int) * k);
+        int rx = editorRowRxMark(row, row->numRxMarks);
+        for(int m = row->numRxMarks; m < k; m++) {
+            rx = editorRowScanRx(row, m * RX_MARK_STRIDE, (m + 1) * RX_MARK_STRIDE, rx);
+            row->rxMarks[m] = rx;
         }
-        cur_rx++;
+        row->numRxMarks = k;
+    }
+    return row->rxMarks[k - 1];
+}
+
+// convert a chars index into a render index
+int editorRowCxToRx(erow *row, int cx) {
+    int k = cx / RX_MARK_STRIDE;
+    return editorRowScanRx(row, k * RX_MARK_STRIDE, cx, editorRowRxMark(row, k));
+}
+
+int editorRowRxToCx(erow *row, int rx) {
+    // start from the last mark at or before rx, marks are never past their chars index
+    int lo = 0, hi = row->size / RX_MARK_STRIDE;
+    if(hi > rx / RX_MARK_STRIDE) hi = rx / RX_MARK_STRIDE;
+    editorRowRxMark(row, hi);
+    while(lo < hi) {
+        int mid = (lo + hi + 1) / 2;
+        if(editorRowRxMark(row, mid) <= rx) lo = mid;
+        else hi = mid - 1;
+    }
+    int cur_rx = editorRowRxMark(row, lo);
+    int cx;
+    for(cx = lo * RX_MARK_STRIDE; cx < row->size; cx++) {
+        if(row->chars[cx] == '\t') {
+            cur_rx += (CACTUS_TAB_STOP - 1) - (cur_rx % CACTUS_TAB_STOP);
+        }
+        cur_rx++;
+
+        if(cur_rx > rx) return cx;
+    }
+    return cx; // just in case caller provided a rx that is out of range
+}
+
+struct etext *etextNew(size_t len) {
+    struct etext *text = malloc(sizeof(struct etext) + len);
+    if(text == NULL) die("malloc");
+    text->refs = 1;
+    text->len = len;
+    text->mapBase = NULL;
+    return text;
+}
+
+void etextRelease(struct etext *text) {
+    if(--text->refs) return;
+    if(text->mapBase) munmap(text->mapBase, text->mapLen);
+    else free(text);
+}
+
+// copy render and hl borrowed from a restored session (cap 0) so they outlive the snapshot
+void editorRowOwnRender(erow *row) {
+    if(row->render && !row->rcap) {
+        char *render = malloc(row->rsize + 1);
+        memcpy(render, row->render, row->rsize + 1);
+        row->render = render;
+        row->rcap = row->rsize + 1;
+    }
+    if(row->hl && !row->hlcap) {
+        unsigned char *hl = malloc(row->rsize);
+        memcpy(hl, row->hl, row->rsize);
+        row->hl = hl;
+        row->hlcap = row->rsize;
+    }
+}
+
+// make the row own its chars with room for need bytes, copying them out of the block it borrowed from
+void editorRowReserve(erow *row, int need) {
+    if(row->text) {
+        int cap = need > row->size + 1 ? need : row->size + 1;
+        char *chars = malloc(cap);
+        memcpy(chars, row->chars, row->size);
+        chars[row->size] = '\0';
+        editorRowOwnRender(row);
+        etextRelease(row->text);
+        row->text = NULL;
+        row->chars = chars;
+        row->cap = cap;
+    } else {
+        row->chars = editorReserve(row->chars, &row->cap, need);
+    }
+}
+
+// index of the first tab, control or non-ascii byte in s[from, len), len if there is none.
+// looks at 32 (avx2) or 16 (sse2) bytes at a time, or 8 with plain 64 bit arithmetic
+int renderScanSpecial(const char *s, int from, int len) {
+    int j = from;
+#if defined(__AVX2__)
+    const __m256i space32 = _mm256_set1_epi8(0x20), del32 = _mm256_set1_epi8(0x7f);
+    for(; j + 32 <= len; j += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(s + j));
+        // signed compare, so bytes >= 0x80 are below space too
+        __m256i m = _mm256_or_si256(_mm256_cmpgt_epi8(space32, v), _mm256_cmpeq_epi8(v, del32));
+        unsigned mask = _mm256_movemask_epi8(m);
+        if(mask) return j + __builtin_ctz(mask);
+    }
+#endif
+#if defined(__SSE2__)
+    const __m128i space = _mm_set1_epi8(0x20), del = _mm_set1_epi8(0x7f);
+    for(; j + 16 <= len; j += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(s + j));
+        __m128i m = _mm_or_si128(_mm_cmplt_epi8(v, space), _mm_cmpeq_epi8(v, del));
+        int mask = _mm_movemask_epi8(m);
+        if(mask) return j + __builtin_ctz(mask);
+    }
+#elif __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    const uint64_t ones = 0x0101010101010101ULL, high = 0x8080808080808080ULL;
+    for(; j + 8 <= len; j += 8) {
+        uint64_t w;
+        memcpy(&w, s + j, 8);
+        // high bit of each byte below space, equal to del or non-ascii. borrows can only
+        // flag bytes after a real hit, so the lowest flagged byte is exact
+        uint64_t d = w ^ (ones * 0x7f);
+        uint64_t m = ((w - ones * 0x20) & ~w) | ((d - ones) & ~d) | w;
+        m &= high;
+        if(m) return j + (__builtin_ctzll(m) >> 3);
+    }
+#endif
+    for(; j < len; j++) {
+        unsigned char c = s[j];
+        if(c < 0x20 || c >= 0x7f) return j;
+    }
+    return len;
+}
+
+// end of the run of equal hl values starting at from, at most stop
+int hlRunEnd(const unsigned char *hl, int from, int stop) {
+    int j = from + 1;
+#if defined(__SSE2__)
+    const __m128i first = _mm_set1_epi8(hl[from]);
+    for(; j + 16 <= stop; j += 16) {
+        int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(hl + j)), first));
+        if(mask != 0xffff) return j + __builtin_ctz(~mask);
+    }
+#endif
+    while(j < stop && hl[j] == hl[from]) j++;
+    return j;
+}
+
+// render of every empty row that never had text, it's never written to
+char editorEmptyRender[1];
+
+// use the chars string of an erow to fill the contents of the render string in one pass,
+// copying the stretches between tabs and special bytes in bulk
+void editorRenderRow(erow *row) {
+    row->numRxMarks = 0;
+    // empty rows share one render string, so blank lines don't each allocate
+    if(row->size == 0 && !row->rcap) {
+        row->render = editorEmptyRender;
+        row->rsize = 0;
+        row->plain = 1;
+        row->lineHashValid = 0;
+        editorRowStats(row);
+        return;
+    }
+
+    // most tabs are indentation, size for those up front
+    int indent = 0;
+    while(indent < row->size && row->chars[indent] == '\t') indent++;
+    if(!row->rcap) row->render = NULL; // borrowed from a session snapshot
+    row->render = editorReserve(row->render, &row->rcap, row->size + indent * (CACTUS_TAB_STOP - 1) + 1);
+
+    int plain = 1;
+    int index = 0;
+    int j = 0;
+    while(j < row->size) {
+        int next = renderScanSpecial(row->chars, j, row->size);
+        memcpy(&row->render[index], &row->chars[j], next - j);
+        index += next - j;
+        j = next;
+        if(j == row->size) break;
+
+        if(row->chars[j] == '\t') {
+            // render tabs as spaces up to the next tab stop, max # of chars for each tab is 8
+            row->render = editorReserve(row->render, &row->rcap, index + CACTUS_TAB_STOP + row->size - j);
+            do row->render[index++] = ' '; while(index % CACTUS_TAB_STOP != 0);
+        } else {
+            row->render[index++] = row->chars[j];
+            plain = 0;
+        }
+        j++;
+    }
+    row->render[index] = '\0';
+    row->rsize = index;
+    row->plain = plain;
+    row->lineHashValid = 0;
+    editorRowStats(row);
+}
+
+void editorUpdateRow(erow *row) {
+    perfBegin(PERF_ROW_UPDATE);
+    editorRenderRow(row);
+    editorUpdateSyntax(row);
+    perfEnd();
+}
+
+// make room for n rows at `at`
+void editorOpenRows(int at, int n) {
+    if(E.numRows + n > E.rowCap) {
+        while(E.numRows + n > E.rowCap) E.rowCap = E.rowCap ? E.rowCap * 2 : 64;
+        E.row = realloc(E.row, sizeof(erow) * E.rowCap);
+    }
+    memmove(&E.row[at + n], &E.row[at], sizeof(erow) * (E.numRows - at));
+    E.numRows += n;
+    E.dirty++;
+    braceInvalidate(at);
+    statsInsertRows(at, n);
+    rulerInsertRows(at, n);
+    spellRowsMoved(at, n);
+}
+
+// fill in a new row, borrowing its chars from text or copying them if text is NULL
+void editorInitRow(int at, struct etext *text, char *s, size_t len) {
+    erow *row = &E.row[at];
+    row->size = len;
+    if(text) {
+        text->refs++;
+        row->text = text;
+        row->chars = s;
+        row->cap = 0;
+    } else {
+        row->text = NULL;
+        row->chars = malloc(len + 1);
+        row->cap = len + 1;
+        memcpy(row->chars, s, len);
+        row->chars[len] = '\0';
+    }
+
+    row->rsize = 0;
+    row->rcap = 0;
+    row->hlcap = 0;
+    row->render = NULL;
+    row->hl = NULL;
+    // start out ending in the state the row after it was lexed from, so highlighting the new
+    // row carries on into that one only if it changes what it should start in
+    row->hl_state = at > 0 ? E.row[at - 1].hl_state : 0;
+    row->tokens = NULL;
+    row->numTokens = 0;
+    row->tokenCap = 0;
+    row->tokensValid = 0;
+    row->plain = 0;
+    row->defs = NULL;
+    row->numDefs = 0;
+    row->defCap = 0;
+    row->identSig = 0;
+    row->symGen = SY.generation;
+    row->indentWidth = 0;
+    row->braceDelta = 0;
+    row->leadingClosers = 0;
+    row->lineHashValid = 0;
+    row->statsValid = 0;
+    row->rxMarks = NULL;
+    row->numRxMarks = 0;
+    row->rxMarkCap = 0;
+    row->edited = 0;
+}
+
+void editorInsertRowText(int at, struct etext *text, char *s, size_t len) {
+    if (at < 0 || at > E.numRows) return;
+    editorOpenRows(at, 1);
+    editorInitRow(at, text, s, len);
+    editorUpdateRow(&E.row[at]);
+}
+
+void editorInsertRow(int at, char *s, size_t len) {
+    editorInsertRowText(at, NULL, s, len);
+}
+
+// free memory owned by the erow
+void editorFreeRow(erow *row) {
+    // render and hl are borrowed from the snapshot chars came from when their cap is 0
+    if(row->rcap) free(row->render);
+    if(row->hlcap) free(row->hl);
+    if(row->text) etextRelease(row->text);
+    else free(row->chars);
+    free(row->tokens);
+    for(int j = 0; j < row->numDefs; j++) symbolUnref(row->defs[j]);
+    free(row->defs);
+    free(row->rxMarks);
+}
+
+void editorDelRows(int at, int n) {
+    if (at < 0 || n <= 0 || at + n > E.numRows) return;
+    uint32_t before = E.row[at + n - 1].hl_state; // the row after the deleted ones started in
+    symbolBulkBegin();
+    for(int j = at; j < at + n; j++) editorFreeRow(&E.row[j]);
+    // overwrite the deleted row structs with the rest of the rows that come after them
+    memmove(&E.row[at], &E.row[at + n], sizeof(erow) * (E.numRows - at - n));
+    E.numRows -= n;
+    E.dirty++;
+    braceInvalidate(at);
+    statsDeleteRows(at, n);
+    rulerDeleteRows(at, n);
+    spellRowsMoved(at, -n);
+    // it follows a different row now, which may leave it in another comment or string
+    if(at < E.numRows && before != (at > 0 ? E.row[at - 1].hl_state : 0)) editorUpdateSyntax(&E.row[at]);
+    symbolBulkEnd(1);
+}
+
+void editorDelRow(int at) {
+    editorDelRows(at, 1);
+}
+
+void editorRowInsertChar(erow *row, int at, int c) {
+    // validate the index we want to insert the character into
+    if(at < 0 || at > row->size) at = row->size;
+    // allocate one more byte for the chars of the erow
+    // add 2 because we need to also make room for the null byte
+    editorRowReserve(row, row->size + 2);
+    // make room for the new character
+    memmove(&row->chars[at + 1], &row->chars[at], row->size -at + 1);
+    // increase the size of the chars array
+    row->size++;
+    // assign the character to its position in the array
+    row->chars[at] = c;
+    // update render and rsize with the new row content
+    editorUpdateRow(row);
+    rulerMarkEdited(row);
+    E.dirty++;
+}
+
+// insert a string into a row at `at`
+void editorRowInsertString(erow *row, int at, char *s, size_t len) {
+    if(at < 0 || at > row->size) at = row->size;
+    editorRowReserve(row, row->size + len + 1);
+    memmove(&row->chars[at + len], &row->chars[at], row->size - at + 1);
+    memcpy(&row->chars[at], s, len);
+    row->size += len;
+    editorUpdateRow(row);
+    rulerMarkEdited(row);
+    E.dirty++;
+}
+
+// append a string to the end of a row
+void editorRowAppendString(erow *row, char *s, size_t len) {
+    editorRowReserve(row, row->size + len + 1);
+    memcpy(&row->chars[row->size], s, len);
+    row->size += len;
+    row->chars[row->size] = '\0';
+    editorUpdateRow(row);
+    rulerMarkEdited(row);
+    E.dirty++;
+}
+
+// deletes len characters in an erow
+void editorRowDelChars(erow *row, int at, int len) {
+    if (at < 0 || len <= 0 || at + len > row->size) return;
+    editorRowReserve(row, row->size + 1);
+    // overwrite the deleted characters with the characters that come after them
+    memmove(&row->chars[at], &row->chars[at + len], row->size - at - len + 1);
+    row->size -= len;
+    editorUpdateRow(row);
+    rulerMarkEdited(row);
+    E.dirty++;
+}
+
+void editorRowDelChar(erow *row, int at) {
+    editorRowDelChars(row, at, 1);
+}
+
+/*** editor operations ***/
+
+// take a character and use editorRowInsertChar() to insert that character
+// into a position the cursor is at
+void editorInsertChar(int c) {
+    if(E.cy == E.numRows) {
+        // cursor is on the tilde line after the end of the file
+        // so append a new row to the file before inserting character
+        editorInsertRow(E.numRows, "", 0);
+    }
+
+    // move cursor forward so next character the user inserts
+    // will go after the character just inserted
+    editorRowInsertChar(&E.row[E.cy], E.cx, c);
+    E.cx++;
+}
+
+// handle 'enter' keypress
+void editorInsertNewLine() {
+    if(E.cx == 0) {
+        editorInsertRow(E.cy, "", 0);
+        rulerMarkEdited(&E.row[E.cy]);
+    } else {
+        // a borrowed row is split without copying, the new row borrows the tail
+        erow *row = &E.row[E.cy];
+        editorInsertRowText(E.cy + 1, row->text, &row->chars[E.cx], row->size - E.cx);
+        row = &E.row[E.cy];
+        row->size = E.cx;
+        if(!row->text) row->chars[row->size] = '\0';
+        editorUpdateRow(row);
+        rulerMarkEdited(row);
+        rulerMarkEdited(&E.row[E.cy + 1]);
+        E.cy++;
+        editorAutoIndent();
+        return;
+    }
+    E.cy++;
+    E.cx = 0;
+}
+
+// delete the character that is to the left of the cursor
+void editorDelChar() {
+    // if cursor is past the end of the file, nothing to delete
+    if(E.cy == E.numRows) return;
+    if(E.cx == 0 && E.cy == 0) return;
+
+    erow *row = &E.row[E.cy];
+    // if there is a character to the left of the cursor, delete and move cursor one to the left
+    if(E.cx > 0) {
+        editorRowDelChar(row, E.cx - 1);
+        E.cx--;
+    } else {
+        E.cx = E.row[E.cy - 1].size;
+        editorRowAppendString(&E.row[E.cy - 1], row->chars, row->size);
+        editorDelRow(E.cy);
+        E.cy--;
+    }
+}
+
+/*** kill ring ***/
+
+// copies are kept as spans of the blocks rows borrow from, so copying and
+// pasting lines that haven't been edited is metadata work. the edited rows of
+// a copy own their chars, those are copied into one new block per copy
+
+#define KILL_RING_SIZE 8
+
+struct killSpan {
+    struct etext *text;
+    char *s;
+    int len;
+};
+
+// one span per line
+struct killEntry {
+    struct killSpan *spans;
+    int numSpans;
+};
+
+struct killRing {
+    struct killEntry entry[KILL_RING_SIZE];
+    int head; // next entry to fill
+    int count;
+    int yank; // entry the last paste came from, -1 if the last key wasn't a paste
+    int yankX, yankY; // where the last paste started
+};
+
+struct killRing K = { .yank = -1 };
+
+// insert rows borrowing the spans, with one move of the rows after them
+void editorInsertRows(int at, struct killSpan *spans, int n) {
+    if (at < 0 || at > E.numRows || n <= 0) return;
+    perfBegin(PERF_ROW_UPDATE);
+    editorOpenRows(at, n);
+    for(int j = 0; j < n; j++) editorInitRow(at + j, spans[j].text, spans[j].s, spans[j].len);
+    // render them all before highlighting so multiline comments see rendered rows
+    for(int j = 0; j < n; j++) editorRenderRow(&E.row[at + j]);
+    symbolBulkBegin();
+    for(int j = 0; j < n; j++) editorUpdateSyntax(&E.row[at + j]);
+    symbolBulkEnd(1);
+    perfEnd();
+}
+
+// delete the text between (x0, y0) and (x1, y1) and put the cursor there
+void editorDelRange(int x0, int y0, int x1, int y1) {
+    if(y0 == y1) {
+        editorRowDelChars(&E.row[y0], x0, x1 - x0);
+    } else {
+        erow *row = &E.row[y0];
+        row->size = x0;
+        editorRowAppendString(row, &E.row[y1].chars[x1], E.row[y1].size - x1);
+        editorDelRows(y0 + 1, y1 - y0);
+    }
+    E.cx = x0;
+    E.cy = y0;
+}
+
+// the selection from the mark to the cursor in order, 0 if there is none
+int editorSelection(int *x0, int *y0, int *x1, int *y1) {
+    if(!E.markSet || E.numRows == 0) return 0;
+    int ax = E.markX, ay = E.markY, bx = E.cx, by = E.cy;
+    // the mark may be left past the text by edits, the cursor past the last row
+    if(ay >= E.numRows) { ay = E.numRows - 1; ax = E.row[ay].size; }
+    if(by >= E.numRows) { by = E.numRows - 1; bx = E.row[by].size; }
+    if(ax > E.row[ay].size) ax = E.row[ay].size;
+    if(bx > E.row[by].size) bx = E.row[by].size;
+    if(ay > by || (ay == by && ax > bx)) {
+        int t = ax; ax = bx; bx = t;
+        t = ay; ay = by; by = t;
+    }
+    *x0 = ax; *y0 = ay; *x1 = bx; *y1 = by;
+    return ay != by || ax != bx;
+}
+
+void killEntryFree(struct killEntry *e) {
+    for(int j = 0; j < e->numSpans; j++) etextRelease(e->spans[j].text);
+    free(e->spans);
+    e->spans = NULL;
+    e->numSpans = 0;
+}
+
+void editorKillCopy(int x0, int y0, int x1, int y1) {
+    struct killEntry *e = &K.entry[K.head];
+    killEntryFree(e);
+    int n = y1 - y0 + 1;
+    e->spans = malloc(sizeof(struct killSpan) * n);
+    e->numSpans = n;
+
+    size_t owned = 0;
+    int y, ownedRows = 0;
+    for(y = y0; y <= y1; y++) {
+        if(E.row[y].text) continue;
+        owned += (y == y1 ? x1 : E.row[y].size) - (y == y0 ? x0 : 0);
+        ownedRows++;
+    }
+    struct etext *copy = ownedRows ? etextNew(owned) : NULL;
+    char *p = copy ? copy->data : NULL;
+
+    for(y = y0; y <= y1; y++) {
+        erow *row = &E.row[y];
+        struct killSpan *span = &e->spans[y - y0];
+        int start = y == y0 ? x0 : 0;
+        span->len = (y == y1 ? x1 : row->size) - start;
+        if(row->text) {
+            span->text = row->text;
+            span->s = &row->chars[start];
+        } else {
+            memcpy(p, &row->chars[start], span->len);
+            span->text = copy;
+            span->s = p;
+            p += span->len;
+        }
+        span->text->refs++;
+    }
+    if(copy) etextRelease(copy);
+
+    K.head = (K.head + 1) % KILL_RING_SIZE;
+    if(K.count < KILL_RING_SIZE) K.count++;
+}
+
+// paste an entry at the cursor, leaving the cursor after it
+void editorKillPaste(int idx) {
+    struct killEntry *e = &K.entry[idx];
+    if(E.cy == E.numRows) editorInsertRow(E.numRows, "", 0);
+    K.yank = idx;
+    K.yankX = E.cx;
+    K.yankY = E.cy;
+
+    struct killSpan *first = &e->spans[0], *last = &e->spans[e->numSpans - 1];
+    if(e->numSpans == 1) {
+        editorRowInsertString(&E.row[E.cy], E.cx, first->s, first->len);
+        E.cx += first->len;
+        return;
+    }
+    // the rows after the cursor row borrow the spans, the last one gets the rest of the cursor row
+    int n = e->numSpans - 1;
+    editorInsertRows(E.cy + 1, &e->spans[1], n);
+    for(int j = 1; j <= n; j++) rulerMarkEdited(&E.row[E.cy + j]);
+    erow *row = &E.row[E.cy];
+    if(E.cx < row->size) editorRowAppendString(&E.row[E.cy + n], &row->chars[E.cx], row->size - E.cx);
+    row->size = E.cx;
+    editorRowAppendString(row, first->s, first->len);
+    E.cy += n;
+    E.cx = last->len;
+}
+
+void editorCopy(int cut) {
+    int x0, y0, x1, y1;
+    if(!editorSelection(&x0, &y0, &x1, &y1)) {
+        editorSetStatusMessage("No selection, Ctrl-Space sets the mark");
+        return;
+    }
+    editorKillCopy(x0, y0, x1, y1);
+    if(cut) editorDelRange(x0, y0, x1, y1);
+    E.markSet = 0;
+    editorSetStatusMessage("%s %d lines", cut ? "Cut" : "Copied", y1 - y0 + 1);
+}
+
+void editorPaste() {
+    if(K.count == 0) {
+        editorSetStatusMessage("Nothing to paste");
+        return;
+    }
+    E.markSet = 0;
+    editorKillPaste((K.head - 1 + KILL_RING_SIZE) % KILL_RING_SIZE);
+}
+
+// replace the text just pasted with the entry before it in the ring
+void editorPastePrevious(int lastYank) {
+    if(lastYank == -1) {
+        editorSetStatusMessage("Ctrl-Y only works right after a paste");
+        return;
+    }
+    int oldest = (K.head - K.count + KILL_RING_SIZE) % KILL_RING_SIZE;
+    int idx = lastYank == oldest ? (K.head - 1 + KILL_RING_SIZE) % KILL_RING_SIZE
+        : (lastYank - 1 + KILL_RING_SIZE) % KILL_RING_SIZE;
+    editorDelRange(K.yankX, K.yankY, E.cx, E.cy);
+    editorKillPaste(idx);
+}
+
+/*** indentation ***/
+
+// each row caches its indent width and what its braces do to the nesting depth.
+// the deltas are summed in a fenwick tree, so the depth at any row is O(log n).
+// inserting or deleting rows only moves back how far the tree is valid, and it is
+// rebuilt up to the row being asked about when needed
+
+struct braceIndex {
+    int *tree; // 1 based, tree[i] sums the deltas of rows (i - lowbit(i), i]
+    int cap;
+    int valid; // tree[1..valid] is up to date
+};
+
+struct braceIndex BI;
+
+// the indent unit is guessed from the first INDENT_GUESS_ROWS indented rows. they're
+// looked at once when the file is opened or re-indented, rows indented later only count
+// while fewer than that were seen
+
+#define INDENT_GUESS_ROWS 200
+
+struct indentGuess {
+    int seen; // indented rows counted
+    int smallest; // indent width of the least indented of them
+    int tab; // one of them starts with a tab
+};
+
+struct indentGuess IG;
+
+// rows from `row` on moved or changed
+void braceInvalidate(int row) {
+    if(row < BI.valid) BI.valid = row;
+}
+
+void braceUpdate(int row, int diff) {
+    for(int i = row + 1; i <= BI.valid; i += i & -i) BI.tree[i] += diff;
+}
+
+// bring tree[1..upto] up to date, each node is its row's delta plus its children
+void braceExtend(int upto) {
+    if(upto <= BI.valid) return;
+    BI.tree = editorReserve(BI.tree, &BI.cap, sizeof(int) * (upto + 1));
+    for(int i = BI.valid + 1; i <= upto; i++) {
+        int v = E.row[i - 1].braceDelta;
+        for(int c = 1; c < (i & -i); c <<= 1) v += BI.tree[i - c];
+        BI.tree[i] = v;
+    }
+    BI.valid = upto;
+}
+
+// nesting depth after a row
+int braceDepth(int row) {
+    braceExtend(row + 1);
+    int depth = 0;
+    for(int i = row + 1; i > 0; i -= i & -i) depth += BI.tree[i];
+    return depth;
+}
+
+// count an indented row towards the guess while it's still being made
+void editorIndentCount(erow *row) {
+    if(IG.seen >= INDENT_GUESS_ROWS || row->indentWidth == 0 || row->indentWidth == row->rsize) return;
+    if(row->chars[0] == '\t') IG.tab = 1;
+    if(IG.smallest == 0 || row->indentWidth < IG.smallest) IG.smallest = row->indentWidth;
+    IG.seen++;
+}
+
+void editorRowBraces(erow *row) {
+    int delta = 0, closers = 0, leading = 1, i;
+    for(i = 0; i < row->rsize && row->render[i] == ' '; i++);
+    if(i != row->indentWidth) {
+        row->indentWidth = i;
+        editorIndentCount(row);
+    }
+    for(; i < row->rsize; i++) {
+        char c = row->render[i];
+        if(c != '{' && c != '}') {
+            if(c != ' ') leading = 0;
+            continue;
+        }
+        unsigned char hl = row->hl[i];
+        if(hl == HL_COMMENT || hl == HL_MULTI_LINE_COMMENT || hl == HL_STRING) continue;
+        if(c == '{') {
+            delta++;
+            leading = 0;
+        } else {
+            delta--;
+            if(leading) closers++;
+        }
+    }
+    row->leadingClosers = closers;
+    if(delta != row->braceDelta) {
+        int at = editorRowIndex(row);
+        if(at < BI.valid) braceUpdate(at, delta - row->braceDelta);
+        row->braceDelta = delta;
+    }
+}
+
+int editorBraceIndent() {
+    return E.syntax && (E.syntax->flags & HL_BRACE_INDENT);
+}
+
+// guess again from the first indented rows of the buffer
+void editorIndentGuess() {
+    memset(&IG, 0, sizeof(IG));
+    for(int j = 0; j < E.numRows && IG.seen < INDENT_GUESS_ROWS; j++) editorIndentCount(&E.row[j]);
+}
+
+// one level of indentation: 0 for a tab, otherwise the smallest indent among the first indented rows
+int editorIndentUnit() {
+    if(IG.tab) return 0;
+    return IG.smallest >= 2 && IG.smallest <= 8 ? IG.smallest : 4;
+}
+
+// replace a row's leading whitespace, returns 0 if it already had that indentation
+int editorRowSetIndent(erow *row, const char *indent, int len) {
+    int old = 0;
+    while(old < row->size && (row->chars[old] == ' ' || row->chars[old] == '\t')) old++;
+    if(old == len && !memcmp(row->chars, indent, len)) return 0;
+
+    editorRowReserve(row, row->size - old + len + 1);
+    memmove(&row->chars[len], &row->chars[old], row->size - old + 1);
+    memcpy(row->chars, indent, len);
+    row->size += len - old;
+    return 1;
+}
+
+// indentation for `levels` levels of nesting into buf, returns its length
+int editorIndentString(char *buf, int size, int levels, int unit) {
+    int len = unit ? levels * unit : levels;
+    if(len > size) len = size;
+    memset(buf, unit ? ' ' : '\t', len);
+    return len;
+}
+
+// indent the row the cursor was just moved onto by enter
+void editorAutoIndent() {
+    erow *row = &E.row[E.cy];
+    char indent[256];
+    int len;
+    if(editorBraceIndent()) {
+        int depth = braceDepth(E.cy - 1) - row->leadingClosers;
+        len = editorIndentString(indent, sizeof(indent), depth > 0 ? depth : 0, editorIndentUnit());
+    } else {
+        // copy the indentation of the row above
+        erow *prev = &E.row[E.cy - 1];
+        for(len = 0; len < prev->size && len < (int)sizeof(indent) &&
+            (prev->chars[len] == ' ' || prev->chars[len] == '\t'); len++) indent[len] = prev->chars[len];
+    }
+    if(editorRowSetIndent(row, indent, len)) {
+        editorUpdateRow(row);
+        rulerMarkEdited(row);
+    }
+    E.cx = len;
+}
+
+// re-indent the selection, or the whole file, from the nesting depth of each row
+void editorReindent() {
+    if(!editorBraceIndent()) {
+        editorSetStatusMessage("Re-indenting needs a language with braces");
+        return;
+    }
+    int x0, y0, x1, y1;
+    if(!editorSelection(&x0, &y0, &x1, &y1)) {
+        y0 = 0;
+        y1 = E.numRows - 1;
+    }
+    if(y1 < y0) return;
+
+    char indent[256];
+    editorIndentGuess();
+    int unit = editorIndentUnit();
+    int depth = y0 > 0 ? braceDepth(y0 - 1) : 0;
+    int changed = 0;
+    symbolBulkBegin();
+    for(int y = y0; y <= y1; y++) {
+        erow *row = &E.row[y];
+        uint32_t start = y > 0 ? E.row[y - 1].hl_state : 0;
+        int level = depth - row->leadingClosers;
+        depth += row->braceDelta;
+        // leave blank rows, preprocessor lines and rows that start inside a comment or string alone
+        if((start & ~LEX_UNCLOSED) != 0 || row->indentWidth == row->rsize || row->render[row->indentWidth] == '#') continue;
+        int len = editorIndentString(indent, sizeof(indent), level > 0 ? level : 0, unit);
+        if(editorRowSetIndent(row, indent, len)) {
+            editorUpdateRow(row);
+            rulerMarkEdited(row);
+            changed++;
+        }
+    }
+    symbolBulkEnd(1);
+    if(changed) E.dirty++;
+    if(E.cy < E.numRows && E.cx > E.row[E.cy].size) E.cx = E.row[E.cy].size;
+    editorSetStatusMessage("Re-indented %d lines", changed);
+}
+
+/*** row sums ***/
+
+// counts of every row summed over runs of rows, so totals of any range stay cheap while
+// rows move. the rows are split into blocks of about ROW_SUMS_BLOCK, each knowing how many
+// rows it has and the sum of their counts. inserting or deleting rows only changes the
+// row counts of the blocks they're in and drops their sums, which are added up again the
+// next time they're needed. a range walks the blocks and only looks at the rows of the
+// blocks at its two ends. the block last looked up is remembered, edits and ranges near
+// it don't walk from the start
+
+#define ROW_SUMS_BLOCK 1024
+#define ROW_SUMS_FIELDS 3 // most counts a row has
+
+struct rowBlock {
+    int rows;
+    int valid; // sum is up to date
+    int64_t sum[ROW_SUMS_FIELDS];
+};
+
+struct rowSums {
+    int fields; // counts per row
+    void (*count)(erow *row, int64_t *v); // counts of one row
+    struct rowBlock *block;
+    int numBlocks, cap;
+    int finger, fingerStart; // block last looked up and its first row
+};
+
+// block with row `at` in it, the last block for the row after the end
+int rowSumsFind(struct rowSums *rs, int at) {
+    int b = rs->finger, start = rs->fingerStart;
+    while(b > 0 && at < start) start -= rs->block[--b].rows;
+    while(b < rs->numBlocks - 1 && at >= start + rs->block[b].rows) start += rs->block[b++].rows;
+    rs->finger = b;
+    rs->fingerStart = start;
+    return b;
+}
+
+// make room for n blocks at b
+void rowSumsOpen(struct rowSums *rs, int b, int n) {
+    rs->block = editorReserve(rs->block, &rs->cap, sizeof(struct rowBlock) * (rs->numBlocks + n));
+    memmove(&rs->block[b + n], &rs->block[b], sizeof(struct rowBlock) * (rs->numBlocks - b));
+    rs->numBlocks += n;
+}
+
+void rowSumsRemove(struct rowSums *rs, int b, int n) {
+    memmove(&rs->block[b], &rs->block[b + n], sizeof(struct rowBlock) * (rs->numBlocks - b - n));
+    rs->numBlocks -= n;
+}
+
+// n rows were inserted at `at`
+void rowSumsInsert(struct rowSums *rs, int at, int n) {
+    if(rs->numBlocks == 0) {
+        rowSumsOpen(rs, 0, 1);
+        rs->block[0].rows = 0;
+        rs->finger = rs->fingerStart = 0;
+    }
+    int b = rowSumsFind(rs, at);
+    int rows = rs->block[b].rows + n;
+    rs->block[b].rows = rows;
+    rs->block[b].valid = 0;
+    if(rows <= 2 * ROW_SUMS_BLOCK) return;
+    // split it up, the last piece gets what's left over
+    int pieces = rows / ROW_SUMS_BLOCK;
+    rowSumsOpen(rs, b + 1, pieces - 1);
+    for(int i = 0; i < pieces; i++) {
+        rs->block[b + i].rows = i < pieces - 1 ? ROW_SUMS_BLOCK : rows - (pieces - 1) * ROW_SUMS_BLOCK;
+        rs->block[b + i].valid = 0;
+    }
+}
+
+// rows [at, at + n) were deleted
+void rowSumsDelete(struct rowSums *rs, int at, int n) {
+    int first = rowSumsFind(rs, at), b = first, off = at - rs->fingerStart;
+    while(n > 0) {
+        int take = rs->block[b].rows - off;
+        if(take > n) take = n;
+        rs->block[b].rows -= take;
+        rs->block[b].valid = 0;
+        n -= take;
+        off = 0;
+        b++;
+    }
+    // the blocks after the first one that were emptied go
+    int empty = first + 1;
+    while(empty < b && rs->block[empty].rows == 0) empty++;
+    rowSumsRemove(rs, first + 1, empty - first - 1);
+    // and small neighbours are merged, so blocks don't dwindle away
+    if(first + 1 < rs->numBlocks && rs->block[first].rows + rs->block[first + 1].rows <= ROW_SUMS_BLOCK) {
+        rs->block[first].rows += rs->block[first + 1].rows;
+        rowSumsRemove(rs, first + 1, 1);
+    }
+    if(first > 0 && rs->block[first - 1].rows + rs->block[first].rows <= ROW_SUMS_BLOCK) {
+        rs->finger = first - 1;
+        rs->fingerStart -= rs->block[first - 1].rows;
+        rs->block[first - 1].rows += rs->block[first].rows;
+        rs->block[first - 1].valid = 0;
+        rowSumsRemove(rs, first, 1);
+    }
+    if(rs->numBlocks == 1 && rs->block[0].rows == 0) rs->numBlocks = 0;
+}
+
+// whether the block with row `at` has its sum, so a change to the row should be added in
+int rowSumsValid(struct rowSums *rs, int at) {
+    return rs->numBlocks && rs->block[rowSumsFind(rs, at)].valid;
+}
+
+// the counts of row `at` changed by diff
+void rowSumsAdd(struct rowSums *rs, int at, const int64_t *diff) {
+    if(rs->numBlocks == 0) return;
+    struct rowBlock *k = &rs->block[rowSumsFind(rs, at)];
+    if(!k->valid) return;
+    for(int i = 0; i < rs->fields; i++) k->sum[i] += diff[i];
+}
+
+// every row's counts may have changed
+void rowSumsReset(struct rowSums *rs) {
+    for(int b = 0; b < rs->numBlocks; b++) rs->block[b].valid = 0;
+}
+
+// add (sign 1) or take away (sign -1) the counts of rows [r0, r1) one row at a time
+void rowSumsRows(struct rowSums *rs, int r0, int r1, int sign, int64_t *sum) {
+    int64_t v[ROW_SUMS_FIELDS];
+    for(int j = r0; j < r1; j++) {
+        rs->count(&E.row[j], v);
+        for(int i = 0; i < rs->fields; i++) sum[i] += sign * v[i];
+    }
+}
+
+// add the counts of rows [r0, r1) to sum
+void rowSumsRange(struct rowSums *rs, int r0, int r1, int64_t *sum) {
+    if(r0 >= r1) return;
+    int b = rowSumsFind(rs, r0), start = rs->fingerStart;
+    for(; start < r1; start += rs->block[b++].rows) {
+        struct rowBlock *k = &rs->block[b];
+        int end = start + k->rows;
+        int lo = r0 > start ? r0 : start, hi = r1 < end ? r1 : end;
+        // a block only partly in the range looks at whichever rows are fewer, the ones
+        // in the range or the ones around them
+        if(lo != start || hi != end) {
+            if((hi - lo) * 2 <= k->rows) {
+                rowSumsRows(rs, lo, hi, 1, sum);
+                continue;
+            }
+            rowSumsRows(rs, start, lo, -1, sum);
+            rowSumsRows(rs, hi, end, -1, sum);
+        }
+        if(!k->valid) {
+            memset(k->sum, 0, sizeof(k->sum));
+            rowSumsRows(rs, start, end, 1, k->sum);
+            k->valid = 1;
+        }
+        for(int i = 0; i < rs->fields; i++) sum[i] += k->sum[i];
+    }
+}
+
+/*** statistics ***/
+
+// bytes, words and utf-8 characters of the buffer. each row caches its own counts (newline
+// included) and they're summed in row sums, so the totals and any range of rows never
+// rescan the file. editing a row adds the difference in
+
+struct textStats {
+    int64_t bytes;
+    int64_t words;
+    int64_t chars;
+};
+
+// count s[0, len) into st, a word is a run of non-space bytes
+void statsCount(const char *s, int len, struct textStats *st) {
+    int words = 0, chars = 0, space = 1;
+    for(int i = 0; i < len; i++) {
+        unsigned char c = s[i];
+        chars += (c & 0xc0) != 0x80;
+        int sp = c == ' ' || (c >= '\t' && c <= '\r');
+        words += space && !sp;
+        space = sp;
+    }
+    st->bytes += len;
+    st->words += words;
+    st->chars += chars;
+}
+
+void statsRowCount(erow *row) {
+    struct textStats st = { 1, 0, 1 }; // the newline
+    statsCount(row->chars, row->size, &st);
+    row->statBytes = st.bytes;
+    row->statWords = st.words;
+    row->statChars = st.chars;
+    row->statsValid = 1;
+}
+
+void statsRowValues(erow *row, int64_t *v) {
+    if(!row->statsValid) statsRowCount(row);
+    v[0] = row->statBytes;
+    v[1] = row->statWords;
+    v[2] = row->statChars;
+}
+
+struct rowSums ST = { .fields = 3, .count = statsRowValues };
+
+void statsInsertRows(int at, int n) {
+    rowSumsInsert(&ST, at, n);
+}
+
+void statsDeleteRows(int at, int n) {
+    rowSumsDelete(&ST, at, n);
+}
+
+// the row's chars changed, called from editorRenderRow
+void editorRowStats(erow *row) {
+    int at = editorRowIndex(row);
+    if(!rowSumsValid(&ST, at)) {
+        row->statsValid = 0;
+        return;
+    }
+    int64_t diff[3] = { -row->statBytes, -row->statWords, -row->statChars };
+    statsRowCount(row);
+    diff[0] += row->statBytes;
+    diff[1] += row->statWords;
+    diff[2] += row->statChars;
+    rowSumsAdd(&ST, at, diff);
+}
+
+// add the counts of rows [r0, r1) to st
+void statsRows(int r0, int r1, struct textStats *st) {
+    int64_t sum[3] = { 0, 0, 0 };
+    rowSumsRange(&ST, r0, r1, sum);
+    st->bytes += sum[0];
+    st->words += sum[1];
+    st->chars += sum[2];
+}
+
+// counts of the text between (x0, y0) and (x1, y1), only the two end rows are scanned
+void statsRange(int x0, int y0, int x1, int y1, struct textStats *st) {
+    memset(st, 0, sizeof(*st));
+    if(y0 == y1) {
+        statsCount(&E.row[y0].chars[x0], x1 - x0, st);
+        return;
+    }
+    statsRows(y0 + 1, y1, st);
+    st->bytes++; // newline of y0
+    st->chars++;
+    statsCount(&E.row[y0].chars[x0], E.row[y0].size - x0, st);
+    statsCount(E.row[y1].chars, x1, st);
+}
+
+// short form of a count for the status bar
+void statsFormat(char *buf, size_t size, int64_t n) {
+    if(n < 100000) snprintf(buf, size, "%lld", (long long)n);
+    else if(n < 10000000) snprintf(buf, size, "%.1fk", n / 1e3);
+    else if(n < 10000000000LL) snprintf(buf, size, "%.1fM", n / 1e6);
+    else snprintf(buf, size, "%.1fG", n / 1e9);
+}
+
+// word, character and byte counts of the selection, or the buffer when there is none.
+// characters are left out while they're the same as bytes
+void statsStatus(char *buf, size_t size) {
+    struct textStats st = { 0, 0, 0 };
+    int x0, y0, x1, y1, selected = editorSelection(&x0, &y0, &x1, &y1);
+    if(selected) statsRange(x0, y0, x1, y1, &st);
+    else statsRows(0, E.numRows, &st);
+    char words[16], chars[16], bytes[16];
+    statsFormat(words, sizeof(words), st.words);
+    statsFormat(chars, sizeof(chars), st.chars);
+    statsFormat(bytes, sizeof(bytes), st.bytes);
+    if(st.chars == st.bytes) snprintf(buf, size, "%s%s words, %s bytes", selected ? "selected " : "", words, bytes);
+    else snprintf(buf, size, "%s%s words, %s chars, %s bytes", selected ? "selected " : "", words, chars, bytes);
+}
+
+/*** highlight cache ***/
+
+// the highlight state of big files is saved under ~/.cactus/hlcache, keyed by a
+// hash of the file contents, so reopening them skips the editorUpdateSyntax pass.
+// a hit touches its file, and once the directory holds more than HL_CACHE_MAX_FILES
+// or HL_CACHE_MAX_BYTES the files used least recently are removed
+
+#define HL_CACHE_MAGIC "CACHL005"
+#define HL_CACHE_MIN_ROWS 1000
+#define HL_CACHE_MAX_FILES 64
+#define HL_CACHE_MAX_BYTES (256LL << 20)
+
+// followed by, for each row, its varint lexer state, its 8 byte identifier signature,
+// a varint count of the symbols
+// it defines and their (varint length, name), then a varint span count and that
+// many (varint length, class byte) runs covering the render text
+struct hlCacheHeader {
+    char magic[8];
+    uint64_t contentHash;
+    uint64_t syntaxHash; // syntax table and filetype the runs were computed with
+    uint32_t numRows;
+    uint32_t tabStop;
+};
+
+uint64_t hlCacheSyntaxHash() {
+    const struct syntaxTableHeader *h = (const struct syntaxTableHeader *)SDB.table;
+    uint64_t hash = hashBytes64(14695981039346656037ULL, &h->fingerprint, sizeof(h->fingerprint));
+    return hashBytes64(hash, E.syntax->filetype, strlen(E.syntax->filetype));
+}
+
+int hlCachePath(char *buf, size_t size, uint64_t contentHash) {
+    if(editorDataPath(buf, size, "hlcache") == -1) return -1;
+    if(mkdir(buf, 0755) == -1 && errno != EEXIST) return -1;
+    size_t len = strlen(buf);
+    if((size_t)snprintf(buf + len, size - len, "/%016llx",
+        (unsigned long long)contentHash) >= size - len) return -1;
+    return 0;
+}
+
+struct hlCacheFile {
+    char name[17];
+    int64_t size;
+    struct timespec used;
+};
+
+int hlCacheCompareUsed(const void *a, const void *b) {
+    const struct timespec *x = &((const struct hlCacheFile *)a)->used;
+    const struct timespec *y = &((const struct hlCacheFile *)b)->used;
+    if(x->tv_sec != y->tv_sec) return x->tv_sec < y->tv_sec ? -1 : 1;
+    return x->tv_nsec < y->tv_nsec ? -1 : x->tv_nsec > y->tv_nsec;
+}
+
+// remove the least recently used files until the cache is within its limits
+void hlCacheEvict() {
+    char dir[1024], path[1100];
+    if(editorDataPath(dir, sizeof(dir), "hlcache") == -1) return;
+    DIR *d = opendir(dir);
+    if(!d) return;
+    struct hlCacheFile *files = NULL;
+    int numFiles = 0, fileCap = 0;
+    int64_t total = 0;
+    struct dirent *ent;
+    while((ent = readdir(d)) != NULL) {
+        // only finished files, "<hash>.<pid>" ones are still being written
+        if(strlen(ent->d_name) != 16 || strspn(ent->d_name, "0123456789abcdef") != 16) continue;
+        struct stat st;
+        snprintf(path, sizeof(path), "%s/%.16s", dir, ent->d_name);
+        if(stat(path, &st) == -1) continue;
+        files = editorReserve(files, &fileCap, sizeof(struct hlCacheFile) * (numFiles + 1));
+        struct hlCacheFile *f = &files[numFiles++];
+        memcpy(f->name, ent->d_name, sizeof(f->name));
+        f->size = st.st_size;
+        f->used = st.st_mtim;
+        total += st.st_size;
+    }
+    closedir(d);
+
+    if(numFiles > HL_CACHE_MAX_FILES || total > HL_CACHE_MAX_BYTES) {
+        qsort(files, numFiles, sizeof(struct hlCacheFile), hlCacheCompareUsed);
+        for(int i = 0; i < numFiles && (numFiles - i > HL_CACHE_MAX_FILES || total > HL_CACHE_MAX_BYTES); i++) {
+            snprintf(path, sizeof(path), "%s/%.16s", dir, files[i].name);
+            if(unlink(path) == 0) total -= files[i].size;
+        }
+    }
+    free(files);
+}
+
+void hlCachePutVarint(FILE *fp, uint32_t v) {
+    while(v >= 0x80) {
+        fputc((v & 0x7f) | 0x80, fp);
+        v >>= 7;
+    }
+    fputc(v, fp);
+}
+
+int hlCacheGetVarint(const unsigned char **p, const unsigned char *end, uint32_t *v) {
+    *v = 0;
+    for(int shift = 0; shift < 35 && *p < end; shift += 7) {
+        unsigned char b = *(*p)++;
+        *v |= (uint32_t)(b & 0x7f) << shift;
+        if(!(b & 0x80)) return 0;
+    }
+    return -1;
+}
+
+void editorSaveHighlightCache(uint64_t contentHash) {
+    if(E.syntax == NULL || E.numRows < HL_CACHE_MIN_ROWS) return;
+
+    char path[1024], tmp[1100];
+    if(hlCachePath(path, sizeof(path), contentHash) == -1) return;
+    snprintf(tmp, sizeof(tmp), "%s.%d", path, (int)getpid());
+    FILE *fp = fopen(tmp, "w");
+    if(!fp) return;
+
+    struct hlCacheHeader h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, HL_CACHE_MAGIC, 8);
+    h.contentHash = contentHash;
+    h.syntaxHash = hlCacheSyntaxHash();
+    h.numRows = E.numRows;
+    h.tabStop = CACTUS_TAB_STOP;
+    fwrite(&h, sizeof(h), 1, fp);
+
+    for(int j = 0; j < E.numRows; j++) {
+        erow *row = &E.row[j];
+        int i, spans = 0;
+        if(editorRowStale(row)) editorUpdateSyntax(row);
+        hlCachePutVarint(fp, row->hl_state);
+        fwrite(&row->identSig, 8, 1, fp);
+        hlCachePutVarint(fp, row->numDefs);
+        for(i = 0; i < row->numDefs; i++) {
+            struct symbol *sym = &SY.sym[row->defs[i]];
+            hlCachePutVarint(fp, sym->len);
+            fwrite(sym->name, 1, sym->len, fp);
+        }
+        for(i = 0; i < row->rsize; i++) {
+            if(i == 0 || row->hl[i] != row->hl[i - 1]) spans++;
+        }
+        hlCachePutVarint(fp, spans);
+        for(i = 0; i < row->rsize;) {
+            int start = i;
+            while(i < row->rsize && row->hl[i] == row->hl[start]) i++;
+            hlCachePutVarint(fp, i - start);
+            fputc(row->hl[start], fp);
+        }
+    }
+
+    int ok = !ferror(fp);
+    if(fclose(fp) != 0) ok = 0;
+    if(!ok || rename(tmp, path) == -1) unlink(tmp);
+    else hlCacheEvict();
+}
+
+// fill in hl and hl_state of every row from the cache, returns 0 on a miss
+int editorLoadHighlightCache(uint64_t contentHash) {
+    if(E.syntax == NULL || E.numRows < HL_CACHE_MIN_ROWS) return 0;
+
+    char path[1024];
+    if(hlCachePath(path, sizeof(path), contentHash) == -1) return 0;
+    int fd = open(path, O_RDONLY);
+    if(fd == -1) return 0;
+    struct stat st;
+    if(fstat(fd, &st) == -1 || st.st_size < (off_t)sizeof(struct hlCacheHeader)) {
+        close(fd);
+        return 0;
+    }
+    unsigned char *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(map == MAP_FAILED) return 0;
+
+    const unsigned char *end = map + st.st_size;
+    const struct hlCacheHeader *h = (const struct hlCacheHeader *)map;
+    const unsigned char *p = map + sizeof(*h);
+    int ok = !memcmp(h->magic, HL_CACHE_MAGIC, 8) && h->contentHash == contentHash &&
+        h->syntaxHash == hlCacheSyntaxHash() && h->numRows == (uint32_t)E.numRows &&
+        h->tabStop == CACTUS_TAB_STOP && p <= end;
+
+    // the cached highlighting already knows the symbols, nothing is stale
+    symbolBulkBegin();
+    for(int j = 0; ok && j < E.numRows; j++) {
+        erow *row = &E.row[j];
+        if(!row->hlcap) row->hl = NULL;
+        row->hl = editorReserve(row->hl, &row->hlcap, row->rsize);
+        row->tokensValid = 0;
+
+        uint32_t spans, len, numDefs;
+        int at = 0;
+        if(hlCacheGetVarint(&p, end, &row->hl_state) == -1 || end - p < 8) {
+            ok = 0;
+            break;
+        }
+        memcpy(&row->identSig, p, 8);
+        p += 8;
+        if(hlCacheGetVarint(&p, end, &numDefs) == -1 || numDefs > SYMBOL_MAX_ROW_DEFS) {
+            ok = 0;
+            break;
+        }
+        row->defs = editorReserve(row->defs, &row->defCap, sizeof(int) * numDefs);
+        while(ok && row->numDefs < (int)numDefs) {
+            if(hlCacheGetVarint(&p, end, &len) == -1 || len == 0 || len > (uint32_t)(end - p)) ok = 0;
+            else row->defs[row->numDefs++] = symbolRef((const char *)p, len);
+            p += ok ? len : 0;
+        }
+        if(!ok || hlCacheGetVarint(&p, end, &spans) == -1) ok = 0;
+        while(ok && spans--) {
+            if(hlCacheGetVarint(&p, end, &len) == -1 || p >= end ||
+                len > (uint32_t)(row->rsize - at) || *p > HL_MATCH) {
+                ok = 0;
+                break;
+            }
+            memset(&row->hl[at], *p++, len);
+            at += len;
+        }
+        if(at != row->rsize) ok = 0;
+        else editorRowBraces(row);
+    }
+
+    symbolBulkEnd(0);
+    munmap(map, st.st_size);
+    // it was used now, keep it over the ones that weren't
+    if(ok) utimensat(AT_FDCWD, path, NULL, 0);
+    return ok;
+}
+
+/*** file i/o ***/
+
+// build the path of a file in cactus's data directory (~/.cactus), creating the directory
+int editorDataPath(char *buf, size_t size, const char *name) {
+    if(B.running) return -1;
+    char *home = getenv("HOME");
+    if(home == NULL || home[0] == '\0') return -1;
+
+    snprintf(buf, size, "%s/.cactus", home);
+    if(mkdir(buf, 0755) == -1 && errno != EEXIST) return -1;
+    if((size_t)snprintf(buf, size, "%s/.cactus/%s", home, name) >= size) return -1;
+    return 0;
+}
+
+// write all of buf, short writes are retried
+int editorWriteAll(int fd, const char *buf, size_t len) {
+    while(len > 0) {
+        ssize_t n = write(fd, buf, len);
+        if(n == -1) {
+            if(errno == EINTR) continue;
+            return -1;
+        }
+        buf += n;
+        len -= n;
+    }
+    return 0;
+}
+
+// convert array of erow structs into a string strings that writes out to a file
+char *editorRowsToString(int *buffLen) {
+    int totLen = 0;
+    int j;
+    for(j = 0; j < E.numRows; j++) {
+        // add up the lengths of each row of text
+        // add 1 to each one for the newline char we add to the end of each line
+        totLen += E.row[j].size + 1;
+    }
+    // save the total length into buffLen
+    *buffLen = totLen;
+
+    char *buf = malloc(totLen);
+    char *p = buf;
+    // loop through the rows
+    for(j = 0; j < E.numRows; j++) {
+        memcpy(p, E.row[j].chars, E.row[j].size);
+        p += E.row[j].size;
+        *p = '\n'; // append newline character after each row
+        p++;
+    }
+
+    return buf;
+}
+
+// remember the size and mtime of the version of the file just read or written
+void editorStampDisk(const struct stat *st) {
+    E.diskSize = st->st_size;
+    E.diskMtime = (int64_t)st->st_mtim.tv_sec * 1000000000 + st->st_mtim.tv_nsec;
+}
+
+// open and read file from disk
+void editorOpen(char *filename) {
+    perfBegin(PERF_IO);
+    free(E.filename);
+    E.filename = strdup(filename);
+
+    FILE *fp = fopen(filename, "r");
+    if (!fp) die("fopen");
+
+    // read entire file into one block the rows borrow their lines from,
+    // highlighting is done once all rows are in. the size is only a first guess, it's
+    // 0 for /proc files and pipes and a file being written grows meanwhile
+    struct stat st;
+    if(fstat(fileno(fp), &st) == -1) die("fstat");
+    size_t cap = st.st_size > 0 ? (size_t)st.st_size + 1 : 65536, len = 0, n;
+    struct etext *text = etextNew(cap);
+    while((n = fread(text->data + len, 1, cap - len, fp)) > 0) {
+        len += n;
+        if(len < cap) continue;
+        cap *= 2;
+        text = realloc(text, sizeof(struct etext) + cap);
+        if(text == NULL) die("realloc");
+    }
+    text->len = len;
+    fclose(fp);
+    editorStampDisk(&st);
+    uint64_t contentHash = hashBytes64(14695981039346656037ULL, text->data, len);
+    E.syntax = NULL;
+    char *p = text->data, *end = text->data + len;
+    while(p < end) {
+        char *next = memchr(p, '\n', end - p);
+        next = next ? next + 1 : end;
+        char *lineEnd = next;
+        while(lineEnd > p && (lineEnd[-1] == '\n' || lineEnd[-1] == '\r')) lineEnd--;
+        editorInsertRowText(E.numRows, text, p, lineEnd - p);
+        p = next;
+    }
+    etextRelease(text);
+
+    // the rows are in, so the shebang line can be used to pick the syntax too
+    E.syntax = editorDetectSyntax();
+    if(!editorLoadHighlightCache(contentHash)) {
+        editorSelectSyntaxHighlight();
+        editorSaveHighlightCache(contentHash);
+    }
+    E.hlCacheHash = contentHash;
+    E.dirty = 0;
+    editorIndentGuess();
+    perfEnd();
+    gutterReload();
+}
+
+// write the string returned by editorRowsToString() to disk
+void editorSave() {
+    if(jobShowingOutput()) {
+        editorSetStatusMessage("The output isn't saved, Ctrl-O switches back to the file");
+        return;
+    }
+    // if a new file, filename is null
+    if (E.filename == NULL) {
+        E.filename = editorPrompt("Save as: %s (ESC to cancel)", NULL);
+        if (E.filename == NULL) {
+            editorSetStatusMessage("Save aborted");
+            return;
+        }
+        editorSelectSyntaxHighlight();
+    }
+
+    perfBegin(PERF_IO);
+    int len;
+    char *buf = editorRowsToString(&len);
+
+    // create a new file if it doesn't already exist and open it for reading and writing
+    // 0644 is the standard permission for text files
+    int fd = open(E.filename, O_RDWR | O_CREAT, 0644);
+
+    if(fd != -1) {
+        if(ftruncate(fd, len) != -1) {
+            if(editorWriteAll(fd, buf, len) == 0) {
+                struct stat st;
+                if(fstat(fd, &st) == 0) editorStampDisk(&st);
+                close(fd);
+                // the saved contents are what gets reopened next, cache their highlighting
+                uint64_t contentHash = hashBytes64(14695981039346656037ULL, buf, len);
+                if(contentHash != E.hlCacheHash) {
+                    char path[1024];
+                    if(E.hlCacheHash && hlCachePath(path, sizeof(path), E.hlCacheHash) == 0) unlink(path);
+                    editorSaveHighlightCache(contentHash);
+                    E.hlCacheHash = contentHash;
+                }
+                free(buf);
+                E.dirty = 0;
+                rulerSaved();
+                perfEnd();
+                editorSetStatusMessage("%d bytes written to disk.", len);
+                gutterReload();
+                return;
+            }
+        }
+        close(fd);
+    }
+
+    free(buf);
+    perfEnd();
+    editorSetStatusMessage("Can't save! I/O error: %s", strerror(errno));
+}
+
+/*** find ***/
+
+// search runs in slices of SEARCH_SLICE_NS so the prompt keeps reading keys on
+// huge buffers: first the seek for the next match, then a count of all matches
+// for the status bar. a changed query restarts both
+
+#define SEARCH_SLICE_NS 4000000
+#define SEARCH_BLOCK 1024 // rows per entry of blockCounts
+
+// which highlight classes a match may start in, cycled with ctrl-t in the prompt
+enum searchScope {
+    SEARCH_ALL = 0,
+    SEARCH_CODE,
+    SEARCH_COMMENTS,
+    SEARCH_STRINGS,
+    SEARCH_SCOPES
+};
+
+const char *searchScopeNames[] = { "all", "code", "comments", "strings" };
+
+struct searchState {
+    int active;
+    int scope;
+    char *query;
+    int queryLen, queryCap;
+    int direction; // direction of search; 1 - forward; -1 - backward
+    int lastMatch; // index of the row the last match was on
+    int lastCol; // and where it starts in the render
+    // seek for the next match
+    int seekRow, seekLeft;
+    // count of all matches, blockCounts[b] holds the matches in rows [b * SEARCH_BLOCK, ...)
+    int countRow;
+    long total;
+    int *blockCounts;
+    int numBlocks, blockCap;
+    int generation; // bumped when the query or scope changes
+    int ordinalRow, ordinalCol; // match ordinal was computed for
+    long ordinal;
+    // restore text color after search, the buffer is kept for the next match
+    int saved_hl_line;
+    unsigned char *saved_hl;
+    int saved_hl_cap;
+};
+
+struct searchState S = { .lastMatch = -1, .saved_hl_line = -1, .ordinalRow = -1 };
+
+int searchInScope(erow *row, int at) {
+    if(S.scope == SEARCH_ALL) return 1;
+    // the row showing the current match has its real classes saved
+    int showing = editorRowIndex(row) == S.saved_hl_line;
+    if(editorRowStale(row) && !showing) editorUpdateSyntax(row);
+    unsigned char hl = showing ? S.saved_hl[at] : row->hl[at];
+    int comment = hl == HL_COMMENT || hl == HL_MULTI_LINE_COMMENT;
+    switch(S.scope) {
+        case SEARCH_CODE: return !comment && hl != HL_STRING;
+        case SEARCH_COMMENTS: return comment;
+        default: return hl == HL_STRING;
+    }
+}
+
+// first match in scope at or after p in the row's render, NULL if there is none
+char *searchRowMatch(erow *row, char *p) {
+    while((p = strstr(p, S.query)) != NULL) {
+        if(searchInScope(row, p - row->render)) return p;
+        p++;
+    }
+    return NULL;
+}
+
+// matches of a row are taken one after another from its start, by the count and by
+// the arrows alike. the last of them that starts before render column `before`, NULL if none
+char *searchRowMatchBefore(erow *row, int before) {
+    char *last = NULL, *p = row->render;
+    while((p = searchRowMatch(row, p)) != NULL && p - row->render < before) {
+        last = p;
+        p += S.queryLen;
+    }
+    return last;
+}
+
+// how many of them start before `before`
+int searchCountBefore(erow *row, int before) {
+    int n = 0;
+    char *p = row->render;
+    while((p = searchRowMatch(row, p)) != NULL && p - row->render < before) {
+        n++;
+        p += S.queryLen;
+    }
+    return n;
+}
+
+int searchCountRow(erow *row) {
+    return searchCountBefore(row, row->rsize + 1);
+}
+
+// the match after or before the current one on its own row, NULL if it was the last of them
+char *searchRowStep(int direction) {
+    erow *row = &E.row[S.lastMatch];
+    if(S.lastCol + S.queryLen > row->rsize) return NULL;
+    if(direction == 1) return searchRowMatch(row, row->render + S.lastCol + S.queryLen);
+    return searchRowMatchBefore(row, S.lastCol);
+}
+
+void searchClearMatch() {
+    if (S.saved_hl_line != -1) {
+        memcpy(E.row[S.saved_hl_line].hl, S.saved_hl, E.row[S.saved_hl_line].rsize);
+        S.saved_hl_line = -1;
+    }
+}
+
+void searchShowMatch(int current, char *match) {
+    erow *row = &E.row[current];
+    S.lastMatch = current;
+    S.lastCol = match - row->render;
+    E.cy = current;
+    E.cx = editorRowRxToCx(row, match - row->render);
+    E.rowOff = E.numRows;
+
+    S.saved_hl_line = current;
+    S.saved_hl = editorReserve(S.saved_hl, &S.saved_hl_cap, row->rsize);
+    memcpy(S.saved_hl, row->hl, row->rsize);
+    memset(&row->hl[match - row->render], HL_MATCH, S.queryLen);
+}
+
+// make blockCounts cover every row, rows can be added while the count runs
+void searchGrowBlocks() {
+    int blocks = E.numRows / SEARCH_BLOCK + 1;
+    if(blocks <= S.numBlocks) return;
+    S.blockCounts = editorReserve(S.blockCounts, &S.blockCap, blocks * sizeof(int));
+    memset(&S.blockCounts[S.numBlocks], 0, (blocks - S.numBlocks) * sizeof(int));
+    S.numBlocks = blocks;
+}
+
+void searchRestart(char *query) {
+    S.queryLen = strlen(query);
+    S.query = editorReserve(S.query, &S.queryCap, S.queryLen + 1);
+    memcpy(S.query, query, S.queryLen + 1);
+    S.lastMatch = -1;
+    S.direction = 1;
+    S.ordinalRow = -1;
+    S.generation++;
+
+    // an empty query matches nothing
+    S.seekRow = -1;
+    S.seekLeft = S.queryLen ? E.numRows : 0;
+    S.countRow = S.queryLen ? 0 : E.numRows;
+    S.total = 0;
+    S.numBlocks = 0;
+    searchGrowBlocks();
+}
+
+// do one slice of pending search work, returns 1 if there is more to do
+int searchWork() {
+    uint64_t deadline = monotonicNs() + SEARCH_SLICE_NS;
+    int n = 0;
+    perfBegin(PERF_SEARCH);
+
+    // loop through the rows of the file looking for the next match
+    while(S.seekLeft > 0) {
+        int current = S.seekRow + S.direction;
+        if (current == -1) current = E.numRows - 1;
+        else if (current == E.numRows) current = 0;
+        S.seekRow = current;
+        S.seekLeft--;
+
+        // check if query is a substring of the current row, going backwards its last match is next
+        erow *row = &E.row[current];
+        char *match = S.direction == 1 ? searchRowMatch(row, row->render) : searchRowMatchBefore(row, row->rsize + 1);
+        if(match) {
+            searchShowMatch(current, match);
+            S.seekLeft = 0;
+        }
+        if(++n % 256 == 0 && monotonicNs() > deadline) {
+            perfEnd();
+            return 1;
+        }
+    }
+
+    searchGrowBlocks();
+    while(S.queryLen && S.countRow < E.numRows) {
+        int count = searchCountRow(&E.row[S.countRow]);
+        S.blockCounts[S.countRow / SEARCH_BLOCK] += count;
+        S.total += count;
+        S.countRow++;
+        if(++n % 256 == 0 && monotonicNs() > deadline) {
+            perfEnd();
+            return S.countRow < E.numRows;
+        }
+    }
+    perfEnd();
+    return 0;
+}
+
+// position of the current match among all matches, -1 until the count gets there
+long searchOrdinal() {
+    if(S.lastMatch == -1 || S.countRow <= S.lastMatch) return -1;
+    if(S.ordinalRow != S.lastMatch || S.ordinalCol != S.lastCol) {
+        // whole blocks before the match, then the rows of its own block and its own row
+        int block = S.lastMatch / SEARCH_BLOCK;
+        long before = 0;
+        for(int b = 0; b < block; b++) before += S.blockCounts[b];
+        for(int j = block * SEARCH_BLOCK; j < S.lastMatch; j++) before += searchCountRow(&E.row[j]);
+        before += searchCountBefore(&E.row[S.lastMatch], S.lastCol);
+        S.ordinal = before + 1;
+        S.ordinalRow = S.lastMatch;
+        S.ordinalCol = S.lastCol;
+    }
+    return S.ordinal;
+}
+
+// 3401 -> "3,401"
+void formatCount(char *buf, size_t size, long n) {
+    char digits[32];
+    int len = snprintf(digits, sizeof(digits), "%ld", n);
+    size_t at = 0;
+    for(int i = 0; i < len && at + 1 < size; i++) {
+        if(i > 0 && (len - i) % 3 == 0 && at + 2 < size) buf[at++] = ',';
+        buf[at++] = digits[i];
+    }
+    buf[at] = '\0';
+}
+
+// "match 12 of 3,401 (counting...)" for the status bar
+void searchStatus(char *buf, size_t size) {
+    buf[0] = '\0';
+    if(!S.active || S.queryLen == 0) return;
+
+    char total[32], ordinal[32] = "?", scope[16] = "";
+    int counting = S.countRow < E.numRows;
+    formatCount(total, sizeof(total), S.total);
+    long n = searchOrdinal();
+    if(n > 0) formatCount(ordinal, sizeof(ordinal), n);
+    if(S.scope != SEARCH_ALL) snprintf(scope, sizeof(scope), "[%s] ", searchScopeNames[S.scope]);
+
+    if(S.seekLeft > 0) snprintf(buf, size, "%ssearching...", scope);
+    else if(S.lastMatch == -1 && !counting) snprintf(buf, size, "%sno matches", scope);
+    else snprintf(buf, size, "%smatch %s of %s%s", scope, ordinal, total, counting ? " (counting...)" : "");
+}
+
+int editorFindCallback(char *query, int key) {
+    // check if user pressed 'enter' or 'escape', if so, leave search mode
+    if (key == '\r' || key == '\x1b') {
+        searchClearMatch();
+        S.active = 0;
+        S.lastMatch = -1;
+        S.direction = 1;
+        return 0;
+    } else if (key == IDLE_KEY) {
+        // keep working on the current query
+    } else if (key == CTRL_KEY('t')) {
+        searchClearMatch();
+        S.scope = (S.scope + 1) % SEARCH_SCOPES;
+        S.active = 1;
+        searchRestart(query);
+    } else if (S.active && (key == ARROW_RIGHT || key == ARROW_DOWN ||
+        key == ARROW_LEFT || key == ARROW_UP)) {
+        searchClearMatch();
+        S.direction = (key == ARROW_RIGHT || key == ARROW_DOWN) ? 1 : -1;
+        if (S.lastMatch == -1) S.direction = 1;
+        // the next match may be on the same row
+        char *match = S.lastMatch == -1 ? NULL : searchRowStep(S.direction);
+        if(match) {
+            searchShowMatch(S.lastMatch, match);
+            S.seekLeft = 0;
+        } else {
+            S.seekRow = S.lastMatch;
+            S.seekLeft = S.queryLen ? E.numRows : 0;
+        }
+    } else {
+        searchClearMatch();
+        S.active = 1;
+        searchRestart(query);
+    }
+    return searchWork();
+}
+
+void editorFind() {
+    int saved_cx = E.cx;
+    int saved_cy = E.cy;
+    int saved_coloff = E.colOff;
+    int saved_rowoff = E.rowOff;
+
+    char *query = editorPrompt("Search: %s (ESC/Arrows/Enter, Ctrl-T: code/comments/strings)", editorFindCallback);
+
+    if(query) {
+        free(query);
+    } else {
+        E.cx = saved_cx;
+        E.cy = saved_cy;
+        E.colOff = saved_coloff;
+        E.rowOff = saved_rowoff;
+    }
+}
+
+/*** overview ruler ***/
+
+// when the file doesn't fit on the screen its last column stands for the whole file, each
+// screen row for a bucket of file rows. a bucket is marked red if a row in it ends in a
+// string that was never closed, blue if the search being typed matches in it and green if
+// a row in it was edited since the file was opened or saved. edited and unclosed rows are
+// kept in row sums like the statistics. matches are folded into the buckets as the sliced
+// count pass gets through the rows, whole count blocks at a time where they fit in a bucket,
+// so every row is looked at once per query however often the screen is drawn
+
+#define RULER_MIN_COLS 20
+
+enum rulerMark {
+    RULER_NONE = 0,
+    RULER_EDITED,
+    RULER_MATCH,
+    RULER_ERROR
+};
+
+struct rulerState {
+    struct rowSums sums; // edited and unclosed rows
+    // matches in each bucket of the rows counted so far, for the search generation, row
+    // count and screen height they were folded for
+    long *matches;
+    int matchesCap;
+    int matchSearch, matchRows, matchHeight;
+    int matchRow, matchBucket; // next row to fold and its bucket
+    // mark of each screen row and the count it was picked for, from rulerBuild
+    unsigned char *marks;
+    long *counts;
+    int marksCap, countsCap;
+    long most[RULER_ERROR + 1]; // largest count of each mark
+};
+
+int rulerUnclosed(uint32_t state) {
+    return LEX_KIND(state) == LEX_NONE && (state & LEX_UNCLOSED);
+}
+
+void rulerRowValues(erow *row, int64_t *v) {
+    v[0] = row->edited;
+    v[1] = rulerUnclosed(row->hl_state);
+}
+
+struct rulerState RU = { .sums = { .fields = 2, .count = rulerRowValues } };
+
+int rulerWidth() {
+    return E.numRows > E.screenRows && E.screenCols - gutterWidth() > RULER_MIN_COLS;
+}
+
+void rulerInsertRows(int at, int n) {
+    rowSumsInsert(&RU.sums, at, n);
+}
+
+void rulerDeleteRows(int at, int n) {
+    rowSumsDelete(&RU.sums, at, n);
+}
+
+// the row was lexed again, called from editorSetLexState
+void rulerLexChanged(erow *row, uint32_t old) {
+    int64_t diff[2] = { 0, rulerUnclosed(row->hl_state) - rulerUnclosed(old) };
+    if(diff[1]) rowSumsAdd(&RU.sums, editorRowIndex(row), diff);
+}
+
+void rulerMarkEdited(erow *row) {
+    if(row->edited) return;
+    int64_t diff[2] = { 1, 0 };
+    row->edited = 1;
+    rowSumsAdd(&RU.sums, editorRowIndex(row), diff);
+}
+
+// the buffer was written out, nothing is edited anymore
+void rulerSaved() {
+    for(int j = 0; j < E.numRows; j++) E.row[j].edited = 0;
+    rowSumsReset(&RU.sums);
+}
+
+// bucket y covers rows [y * numRows / screenRows, (y + 1) * numRows / screenRows)
+int rulerBucketStart(int y) {
+    return (int)((int64_t)y * E.numRows / E.screenRows);
+}
+
+// fold the rows the count pass got through since the last frame into the buckets
+void rulerFoldMatches() {
+    if(RU.matchSearch != S.generation || RU.matchRows != E.numRows || RU.matchHeight != E.screenRows) {
+        RU.matches = editorReserve(RU.matches, &RU.matchesCap, sizeof(long) * E.screenRows);
+        memset(RU.matches, 0, sizeof(long) * E.screenRows);
+        RU.matchSearch = S.generation;
+        RU.matchRows = E.numRows;
+        RU.matchHeight = E.screenRows;
+        RU.matchRow = RU.matchBucket = 0;
+    }
+    int counted = S.countRow < E.numRows ? S.countRow : E.numRows;
+    while(RU.matchRow < counted) {
+        int r = RU.matchRow, y = RU.matchBucket, end = rulerBucketStart(y + 1);
+        if(r >= end) {
+            RU.matchBucket++;
+            continue;
+        }
+        if(end > counted) end = counted;
+        // a block the count pass has finished that lies inside the bucket
+        if(r % SEARCH_BLOCK == 0 && r + SEARCH_BLOCK <= end && r / SEARCH_BLOCK < S.numBlocks) {
+            RU.matches[y] += S.blockCounts[r / SEARCH_BLOCK];
+            RU.matchRow += SEARCH_BLOCK;
+        } else {
+            RU.matches[y] += searchCountRow(&E.row[r]);
+            RU.matchRow++;
+        }
+    }
+}
+
+// work out the mark of every screen row
+void rulerBuild() {
+    RU.marks = editorReserve(RU.marks, &RU.marksCap, E.screenRows);
+    RU.counts = editorReserve(RU.counts, &RU.countsCap, sizeof(long) * E.screenRows);
+    memset(RU.most, 0, sizeof(RU.most));
+    int searching = S.active && S.queryLen;
+    if(searching) rulerFoldMatches();
+    for(int y = 0; y < E.screenRows; y++) {
+        int64_t sum[2] = { 0, 0 };
+        rowSumsRange(&RU.sums, rulerBucketStart(y), rulerBucketStart(y + 1), sum);
+        long edited = sum[0], errors = sum[1], matches = searching ? RU.matches[y] : 0;
+        if(errors) {
+            RU.marks[y] = RULER_ERROR;
+            RU.counts[y] = errors;
+        } else if(matches) {
+            RU.marks[y] = RULER_MATCH;
+            RU.counts[y] = matches;
+        } else {
+            RU.marks[y] = edited ? RULER_EDITED : RULER_NONE;
+            RU.counts[y] = edited;
+        }
+        if(RU.counts[y] > RU.most[RU.marks[y]]) RU.most[RU.marks[y]] = RU.counts[y];
+    }
+}
+
+// escape sequence drawing screen row y's cell in the last column, the densest bucket of
+// a mark gets a '#', the bucket the cursor is in is in inverse video
+int rulerCell(char *buf, size_t size, int y) {
+    static const char *colors[] = { "", "\x1b[32m", "\x1b[34m", "\x1b[31m" };
+    int mark = RU.marks[y];
+    long most = RU.most[mark];
+    int level = most ? (3 * RU.counts[y] + most - 1) / most : 0;
+    int r0 = rulerBucketStart(y), r1 = rulerBucketStart(y + 1);
+    int here = E.cy >= r0 && (E.cy < r1 || y == E.screenRows - 1);
+    return snprintf(buf, size, "\x1b[%d;%dH%s%s%c\x1b[m", y + 1, E.screenCols,
+        here ? "\x1b[7m" : "", colors[mark], " .:#"[level]);
+}
+
+/*** stream replace ***/
+
+// cactus --replace PATTERN REPLACEMENT FILE [--regex] rewrites a file of any size
+// without loading it. it's read in chunks, replaced into an output buffer that a writer
+// thread flushes to a temp file while the next chunk is read, and the temp file is
+// renamed over the original at the end
+
+#define REPLACE_CHUNK (4 << 20)
+
+struct replaceBuf {
+    char *b;
+    int len;
+    int cap;
+};
+
+struct replaceState {
+    const char *pattern;
+    int patLen;
+    const char *repl;
+    int replLen;
+    int regex;
+    regex_t re;
+    long long matches;
+
+    int out;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    struct replaceBuf buf[2]; // one is filled while the writer writes the other
+    int full[2]; // handed to the writer
+    int cur; // the one being filled
+    int done;
+    int error; // errno of a failed write
+};
+
+struct replaceState RS = { .lock = PTHREAD_MUTEX_INITIALIZER, .cond = PTHREAD_COND_INITIALIZER };
+
+void *replaceWriter(void *arg) {
+    (void)arg;
+    for(int i = 0;; i ^= 1) {
+        pthread_mutex_lock(&RS.lock);
+        while(!RS.full[i] && !RS.done) pthread_cond_wait(&RS.cond, &RS.lock);
+        if(!RS.full[i]) {
+            pthread_mutex_unlock(&RS.lock);
+            return NULL;
+        }
+        int failed = RS.error;
+        pthread_mutex_unlock(&RS.lock);
+
+        int err = !failed && editorWriteAll(RS.out, RS.buf[i].b, RS.buf[i].len) == -1 ? errno : 0;
+
+        pthread_mutex_lock(&RS.lock);
+        if(err) RS.error = err;
+        RS.full[i] = 0;
+        pthread_cond_broadcast(&RS.cond);
+        pthread_mutex_unlock(&RS.lock);
+    }
+}
+
+// hand the filled buffer to the writer and wait for the other one to be free, returns -1 once a write failed
+int replaceFlush() {
+    pthread_mutex_lock(&RS.lock);
+    RS.full[RS.cur] = 1;
+    RS.cur ^= 1;
+    pthread_cond_broadcast(&RS.cond);
+    while(RS.full[RS.cur] && !RS.error) pthread_cond_wait(&RS.cond, &RS.lock);
+    int err = RS.error;
+    pthread_mutex_unlock(&RS.lock);
+    RS.buf[RS.cur].len = 0;
+    return err ? -1 : 0;
+}
+
+int replaceAppend(const char *s, int len) {
+    if(len == 0) return 0;
+    struct replaceBuf *b = &RS.buf[RS.cur];
+    b->b = editorReserve(b->b, &b->cap, b->len + len);
+    memcpy(&b->b[b->len], s, len);
+    b->len += len;
+    return b->len >= REPLACE_CHUNK ? replaceFlush() : 0;
+}
+
+// first match in s[from, len), its length goes in *mlen. -1 if there is none
+int replaceFind(const char *s, int from, int len, int *mlen) {
+    if(from > len) return -1;
+    if(!RS.regex) {
+        const char *p = memmem(s + from, len - from, RS.pattern, RS.patLen);
+        *mlen = RS.patLen;
+        return p ? p - s : -1;
+    }
+    // matches don't cross lines, so ^ only matches at the start of the chunk if a line starts there
+    regmatch_t m = { .rm_so = from, .rm_eo = len };
+    int flags = REG_STARTEND | (from > 0 && s[from - 1] != '\n' ? REG_NOTBOL : 0) |
+        (len > 0 && s[len - 1] == '\n' ? REG_NOTEOL : 0);
+    if(regexec(&RS.re, s, 1, &m, flags) != 0) return -1;
+    *mlen = m.rm_eo - m.rm_so;
+    return m.rm_so;
+}
+
+// replace the matches that can't reach past `safe`, returns how much of the chunk is done with.
+// at the end of the file an empty match can also go at the very end, if the last line has no newline
+int replaceChunk(const char *in, int have, int safe, int eof) {
+    int pos = 0, at, mlen, lastEnd = -1;
+    while((at = replaceFind(in, pos, RS.regex ? safe : have, &mlen)) != -1 &&
+        (at < safe || (eof && at == safe && have > 0 && in[have - 1] != '\n'))) {
+        // an empty match right where the last one ended doesn't count, like sed
+        int skip = mlen == 0 && at == lastEnd;
+        if(replaceAppend(&in[pos], at - pos) == -1 || (!skip && replaceAppend(RS.repl, RS.replLen) == -1)) return -1;
+        RS.matches += !skip;
+        pos = lastEnd = at + mlen;
+        // step over a character after an empty match so it isn't found again
+        if(mlen == 0) {
+            if(at < have && replaceAppend(&in[at], 1) == -1) return -1;
+            pos++;
+        }
+    }
+    if(pos > have) return have;
+    if(pos < safe) {
+        if(replaceAppend(&in[pos], safe - pos) == -1) return -1;
+        pos = safe;
+    }
+    return pos;
+}
+
+int streamReplace(const char *filename, const char *pattern, const char *repl, int regex) {
+    RS.pattern = pattern;
+    RS.patLen = strlen(pattern);
+    RS.repl = repl;
+    RS.replLen = strlen(repl);
+    RS.regex = regex;
+    if(RS.patLen == 0 || RS.patLen > REPLACE_CHUNK / 2) {
+        fprintf(stderr, "cactus: the pattern has to be 1 to %d bytes\n", REPLACE_CHUNK / 2);
+        return 1;
+    }
+    if(regex) {
+        int err = regcomp(&RS.re, pattern, REG_EXTENDED | REG_NEWLINE);
+        if(err != 0) {
+            char msg[256];
+            regerror(err, &RS.re, msg, sizeof(msg));
+            fprintf(stderr, "cactus: %s: %s\n", pattern, msg);
+            return 1;
+        }
+    }
+
+    int in = open(filename, O_RDONLY);
+    struct stat st;
+    if(in == -1 || fstat(in, &st) == -1) {
+        fprintf(stderr, "cactus: %s: %s\n", filename, strerror(errno));
+        return 1;
+    }
+    posix_fadvise(in, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    // the temp file goes next to the original so the rename stays on one file system
+    char tmp[1024];
+    if((size_t)snprintf(tmp, sizeof(tmp), "%s.cactus-XXXXXX", filename) >= sizeof(tmp) ||
+        (RS.out = mkstemp(tmp)) == -1) {
+        fprintf(stderr, "cactus: can't create a temp file for %s: %s\n", filename, strerror(errno));
+        close(in);
+        return 1;
+    }
+    fchmod(RS.out, st.st_mode & 07777);
+
+    pthread_t writer;
+    pthread_create(&writer, NULL, replaceWriter, NULL);
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    // one more for a NUL, regexec is only told where to stop but some versions look for it anyway
+    char *chunk = malloc(REPLACE_CHUNK + 1);
+    int have = 0, eof = 0, failed = 0;
+    long long total = 0;
+    while(!eof && !failed) {
+        while(have < REPLACE_CHUNK) {
+            ssize_t n = read(in, chunk + have, REPLACE_CHUNK - have);
+            if(n == -1 && errno == EINTR) continue;
+            if(n <= 0) {
+                // kept now, the writer thread and the clock can change errno before it's read
+                eof = 1;
+                failed = n == -1 ? errno : 0;
+                break;
+            }
+            have += n;
+            total += n;
+        }
+
+        // a literal match can start up to its length from the end and still be cut off,
+        // a regex one anywhere on the last line. a chunk that is all one line gets matched as is
+        int safe = have;
+        if(!eof && !RS.regex) safe = have - (RS.patLen - 1);
+        else if(!eof) {
+            char *nl = memrchr(chunk, '\n', have);
+            if(nl) safe = nl - chunk + 1;
+        }
+        chunk[have] = '\0';
+        int done = replaceChunk(chunk, have, safe, eof);
+        if(done == -1) break;
+        // the rest overlaps into the next chunk
+        memmove(chunk, chunk + done, have - done);
+        have -= done;
+    }
+    if(!failed && RS.buf[RS.cur].len) replaceFlush();
+
+    pthread_mutex_lock(&RS.lock);
+    RS.done = 1;
+    pthread_cond_broadcast(&RS.cond);
+    pthread_mutex_unlock(&RS.lock);
+    pthread_join(writer, NULL);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    int err = failed ? failed : RS.error;
+    if(!err && fdatasync(RS.out) == -1) err = errno;
+    if(close(RS.out) == -1 && !err) err = errno;
+    close(in);
+    free(chunk);
+    free(RS.buf[0].b);
+    free(RS.buf[1].b);
+    if(regex) regfree(&RS.re);
+
+    // nothing changed, leave the original alone
+    if(err || RS.matches == 0 || rename(tmp, filename) == -1) {
+        if(!err && RS.matches) err = errno;
+        unlink(tmp);
+    }
+    if(err) {
+        fprintf(stderr, "cactus: %s: %s\n", filename, strerror(err));
+        return 1;
+    }
+    double secs = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    printf("%lld replacements, %.1f MB in %.2fs (%.0f MB/s)\n", RS.matches, total / 1e6, secs,
+        secs > 0 ? total / 1e6 / secs : 0);
+    return 0;
+}
+
+/*** jobs ***/
+
+// Ctrl-K runs a command, like make, with its output going into a second buffer,
+// Ctrl-O switches between it and the file. the output is read from a non-blocking pipe
+// whenever no key is pending, a slice at a time, and complete lines are appended as rows
+// borrowing from big blocks. file:line:col locations are collected as lines arrive and
+// Ctrl-N / Ctrl-P jump to the next or previous one
+
+#define JOB_BLOCK (256 << 10)
+#define JOB_READ (64 << 10)
+#define JOB_SLICE_NS 4000000
+
+// what is kept of the buffer that isn't shown
+struct editorBuffer {
+    int cx, cy, rowOff, colOff;
+    int numRows, rowCap;
+    erow *row;
+    int dirty;
+    char *filename;
+    struct editorSyntax *syntax;
+    uint64_t hlCacheHash;
+    int64_t diskSize, diskMtime;
+    int markSet, markX, markY;
+    struct braceIndex bi;
+    struct indentGuess ig;
+    struct rowSums st;
+    struct rowSums ru; // the ruler's
+};
+
+struct jobLocation {
+    int row; // row of the output it was found on
+    int line, col;
+    int file, fileLen; // name in the names pool
+};
+
+struct jobState {
+    pid_t pid; // 0 if no job is running
+    int fd; // read end of the output pipe, -1 once it's closed
+    char command[256];
+    int status;
+
+    int showing; // the output is in E and the file is in other
+    struct editorBuffer other;
+
+    struct etext *block; // the block output is read into
+    size_t used; // bytes of it filled
+    size_t lineStart; // start of the line that hasn't ended yet, or of the held lines
+    int held; // a prompt is open, lines are read but not appended
+    int exitHeld; // it exited meanwhile, the message waits for the held lines
+    struct killSpan *spans; // complete lines of one read
+    int spanCap;
+
+    struct jobLocation *locs;
+    int numLocs, locCap;
+    int current;
+    char *names;
+    int namesLen, namesCap;
+
+    int redraw; // output arrived since the screen was drawn
+    uint64_t lastFrame;
+};
+
+// the output buffer sums its rows like the file does
+struct jobState J = { .fd = -1, .current = -1, .other = {
+    .st = { .fields = 3, .count = statsRowValues }, .ru = { .fields = 2, .count = rulerRowValues } } };
+
+int jobShowingOutput() {
+    return J.showing;
+}
+
+// switch E between the file and the output
+void jobSwapBuffers() {
+    struct editorBuffer shown = {
+        E.cx, E.cy, E.rowOff, E.colOff, E.numRows, E.rowCap, E.row, E.dirty, E.filename,
+        E.syntax, E.hlCacheHash, E.diskSize, E.diskMtime, E.markSet, E.markX, E.markY, BI, IG, ST, RU.sums
+    };
+    struct editorBuffer *b = &J.other;
+    E.cx = b->cx;
+    E.cy = b->cy;
+    E.rowOff = b->rowOff;
+    E.colOff = b->colOff;
+    E.numRows = b->numRows;
+    E.rowCap = b->rowCap;
+    E.row = b->row;
+    E.dirty = b->dirty;
+    E.filename = b->filename;
+    E.syntax = b->syntax;
+    E.hlCacheHash = b->hlCacheHash;
+    E.diskSize = b->diskSize;
+    E.diskMtime = b->diskMtime;
+    E.markSet = b->markSet;
+    E.markX = b->markX;
+    E.markY = b->markY;
+    BI = b->bi;
+    IG = b->ig;
+    ST = b->st;
+    RU.sums = b->ru;
+    *b = shown;
+    J.showing ^= 1;
+}
+
+// "file:line:col" or "file:line" at the start of a line, returns 0 if there is none
+int jobParseLocation(const char *s, int len, struct jobLocation *loc) {
+    int i = 0;
+    while(i < len && s[i] != ':' && !isspace((unsigned char)s[i])) i++;
+    if(i == 0 || i == len || s[i] != ':') return 0;
+    int fileLen = i++;
+    if(i == len || !isdigit((unsigned char)s[i])) return 0;
+    int line = 0, col = 0;
+    while(i < len && isdigit((unsigned char)s[i])) line = line * 10 + (s[i++] - '0');
+    if(i == len || s[i] != ':') return 0;
+    if(++i < len && isdigit((unsigned char)s[i])) {
+        while(i < len && isdigit((unsigned char)s[i])) col = col * 10 + (s[i++] - '0');
+        if(i == len || s[i] != ':') col = 0;
+    }
+    loc->line = line;
+    loc->col = col;
+    loc->file = J.namesLen;
+    loc->fileLen = fileLen;
+    J.names = editorReserve(J.names, &J.namesCap, J.namesLen + fileLen + 1);
+    memcpy(&J.names[J.namesLen], s, fileLen);
+    J.names[J.namesLen + fileLen] = '\0';
+    J.namesLen += fileLen + 1;
+    return 1;
+}
+
+// append the lines that ended in the block since `from`, all at once
+void jobAppendLines(size_t from) {
+    if(J.held) return;
+    char *data = J.block->data;
+    int n = 0;
+    char *nl;
+    while((nl = memchr(data + from, '\n', J.used - from)) != NULL) {
+        size_t end = nl - data;
+        size_t lineEnd = end;
+        if(lineEnd > J.lineStart && data[lineEnd - 1] == '\r') lineEnd--;
+        J.spans = editorReserve(J.spans, &J.spanCap, sizeof(struct killSpan) * (n + 1));
+        J.spans[n++] = (struct killSpan){ J.block, data + J.lineStart, lineEnd - J.lineStart };
+        from = J.lineStart = end + 1;
+    }
+    if(n == 0) return;
+
+    int shown = J.showing;
+    if(!shown) jobSwapBuffers();
+    int at = E.numRows;
+    int follow = E.cy >= at - 1;
+    editorInsertRows(at, J.spans, n);
+    for(int j = 0; j < n; j++) {
+        J.locs = editorReserve(J.locs, &J.locCap, sizeof(struct jobLocation) * (J.numLocs + 1));
+        struct jobLocation *loc = &J.locs[J.numLocs];
+        if(jobParseLocation(J.spans[j].s, J.spans[j].len, loc)) {
+            loc->row = at + j;
+            J.numLocs++;
+        }
+    }
+    // the output is never saved
+    E.dirty = 0;
+    // keep showing the end if that's where the cursor was
+    if(follow) {
+        E.cy = E.numRows - 1;
+        E.cx = 0;
+    }
+    if(!shown) jobSwapBuffers();
+    J.redraw = 1;
+}
+
+void jobExitMessage() {
+    int code = WIFEXITED(J.status) ? WEXITSTATUS(J.status) : 128 + WTERMSIG(J.status);
+    editorSetStatusMessage("%s exited with %d, %d locations (Ctrl-N/Ctrl-P to jump, Ctrl-O for output)",
+        J.command, code, J.numLocs);
+    J.exitHeld = 0;
+    J.redraw = 1;
+}
+
+// while a prompt is open the rows it works on (the search count, the match being shown)
+// stay as they were, the output read meanwhile is appended when it closes
+void jobHold(int hold) {
+    J.held = hold;
+    if(hold) return;
+    if(J.block && J.used > J.lineStart) jobAppendLines(J.lineStart);
+    if(J.exitHeld) jobExitMessage();
+}
+
+// read output for a slice, returns once the pipe is empty
+void jobRead() {
+    uint64_t deadline = monotonicNs() + JOB_SLICE_NS;
+    do {
+        // the unfinished line moves into a new block when there isn't room to read
+        if(!J.block || J.block->len - J.used < JOB_READ) {
+            size_t partial = J.block ? J.used - J.lineStart : 0;
+            size_t size = JOB_BLOCK > partial * 2 ? JOB_BLOCK : partial * 2;
+            struct etext *block = etextNew(size);
+            if(partial) memcpy(block->data, J.block->data + J.lineStart, partial);
+            if(J.block) etextRelease(J.block);
+            J.block = block;
+            J.used = partial;
+            J.lineStart = 0;
+        }
+        ssize_t n = read(J.fd, J.block->data + J.used, J.block->len - J.used);
+        if(n == -1 && errno == EINTR) continue;
+        if(n == -1 && errno == EAGAIN) return;
+        if(n <= 0) {
+            // the last line may not have a newline
+            if(J.used > J.lineStart && J.block->data[J.used - 1] != '\n') {
+                J.block->data[J.used++] = '\n';
+                jobAppendLines(J.used - 1);
+            }
+            close(J.fd);
+            J.fd = -1;
+            return;
+        }
+        size_t from = J.used;
+        J.used += n;
+        jobAppendLines(from);
+    } while(monotonicNs() < deadline);
+}
+
+void jobReap() {
+    if(J.pid <= 0 || waitpid(J.pid, &J.status, WNOHANG) != J.pid) return;
+    J.pid = 0;
+    if(J.held) J.exitHeld = 1;
+    else jobExitMessage();
+}
+
+// stop the running job, if there is one
+void jobStop() {
+    if(J.fd != -1) {
+        close(J.fd);
+        J.fd = -1;
+    }
+    if(J.pid > 0) {
+        // give it a second to clean up before killing it
+        kill(-J.pid, SIGTERM);
+        for(int i = 0; i < 100 && waitpid(J.pid, &J.status, WNOHANG) == 0; i++) usleep(10000);
+        if(kill(-J.pid, SIGKILL) == 0) waitpid(J.pid, &J.status, 0);
+        J.pid = 0;
+    }
+}
+
+void jobStart(const char *command) {
+    static int registered = 0;
+    if(!registered) {
+        atexit(jobStop);
+        registered = 1;
+    }
+    jobStop();
+
+    // start over with an empty output buffer
+    int shown = J.showing;
+    if(!shown) jobSwapBuffers();
+    editorDelRows(0, E.numRows);
+    E.cx = E.cy = E.rowOff = E.colOff = 0;
+    E.markSet = 0;
+    E.dirty = 0;
+    free(E.filename);
+    snprintf(J.command, sizeof(J.command), "%s", command);
+    E.filename = malloc(strlen(command) + 3);
+    sprintf(E.filename, "[%s]", command);
+    if(!shown) jobSwapBuffers();
+    if(J.block) etextRelease(J.block);
+    J.block = NULL;
+    J.numLocs = 0;
+    J.namesLen = 0;
+    J.current = -1;
+    J.exitHeld = 0;
+
+    int fds[2];
+    if(pipe(fds) == -1) {
+        editorSetStatusMessage("Can't run %s: %s", command, strerror(errno));
+        return;
+    }
+    pid_t pid = fork();
+    if(pid == -1) {
+        close(fds[0]);
+        close(fds[1]);
+        editorSetStatusMessage("Can't run %s: %s", command, strerror(errno));
+        return;
+    }
+    if(pid == 0) {
+        // in its own process group, so stopping it stops everything it started
+        setpgid(0, 0);
+        int null = open("/dev/null", O_RDONLY);
+        dup2(null, STDIN_FILENO);
+        dup2(fds[1], STDOUT_FILENO);
+        dup2(fds[1], STDERR_FILENO);
+        close(fds[0]);
+        close(fds[1]);
+        execl("/bin/sh", "sh", "-c", command, (char *)NULL);
+        _exit(127);
+    }
+    setpgid(pid, pid);
+    close(fds[1]);
+    fcntl(fds[0], F_SETFL, O_NONBLOCK);
+    fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+    J.pid = pid;
+    J.fd = fds[0];
+    editorSetStatusMessage("Running %s... (Ctrl-O for output)", command);
+}
+
+void jobRun() {
+    char *command = editorPrompt("Run: %s (ESC to cancel)", NULL);
+    if(command == NULL) return;
+    jobStart(command);
+    free(command);
+}
+
+void jobToggleOutput() {
+    if(J.command[0] == '\0') {
+        editorSetStatusMessage("Nothing has run yet, Ctrl-K runs a command");
+        return;
+    }
+    jobSwapBuffers();
+}
+
+int jobSameFile(const char *a, const char *b) {
+    struct stat sa, sb;
+    if(stat(a, &sa) == -1 || stat(b, &sb) == -1) return !strcmp(a, b);
+    return sa.st_dev == sb.st_dev && sa.st_ino == sb.st_ino;
+}
+
+// go to the next (dir 1) or previous (dir -1) location in the output
+void jobJump(int dir) {
+    if(J.numLocs == 0) {
+        editorSetStatusMessage("No locations in the output");
+        return;
+    }
+    J.current = (J.current + dir + J.numLocs) % J.numLocs;
+    struct jobLocation *loc = &J.locs[J.current];
+    const char *file = &J.names[loc->file];
+
+    // the output's cursor goes to the line the location is on
+    if(!J.showing) jobSwapBuffers();
+    char msg[80];
+    erow *row = &E.row[loc->row];
+    snprintf(msg, sizeof(msg), "[%d/%d] %.*s", J.current + 1, J.numLocs, row->rsize, row->render);
+    E.cy = loc->row;
+    E.cx = 0;
+    jobSwapBuffers();
+
+    if(!E.filename || !jobSameFile(E.filename, file)) {
+        if(E.dirty) {
+            editorSetStatusMessage("Save %s before jumping to %s", E.filename ? E.filename : "the file", file);
+            return;
+        }
+        if(access(file, R_OK) == -1) {
+            editorSetStatusMessage("Can't open %s: %s", file, strerror(errno));
+            return;
+        }
+        editorDelRows(0, E.numRows);
+        E.cx = E.cy = E.rowOff = E.colOff = 0;
+        E.markSet = 0;
+        editorOpen((char *)file);
+    }
+    if(E.numRows > 0) {
+        E.cy = loc->line - 1 < E.numRows ? loc->line - 1 : E.numRows - 1;
+        if(E.cy < 0) E.cy = 0;
+        E.cx = loc->col > 0 ? loc->col - 1 : 0;
+        if(E.cx > E.row[E.cy].size) E.cx = E.row[E.cy].size;
+        // put the line in the middle of the screen
+        E.rowOff = E.cy > E.screenRows / 2 ? E.cy - E.screenRows / 2 : 0;
+    }
+    editorSetStatusMessage("%s", msg);
+}
+
+/*** git gutter ***/
+
+// rows changed since the git index get a mark in a gutter left of the text. a worker
+// thread reads the file's blob from the index with git cat-file when it's opened or
+// saved and diffs it against hashes of the rows, which are handed over once edits have
+// settled for a moment. drawing only looks at the marks of the last finished diff
+
+#define GUTTER_WIDTH 2
+#define GUTTER_DEBOUNCE_NS 300000000
+#define GUTTER_MAX_EDITS 2000 // past this many edits the changed middle is marked as a whole
+
+enum gutterMark {
+    GUTTER_NONE = 0,
+    GUTTER_ADDED,
+    GUTTER_MODIFIED,
+    GUTTER_DELETED // lines were deleted above this one
+};
+
+struct gutterState {
+    int enabled; // a worker is running for the file
+    int tracked; // the file is in the index, so there's a gutter
+    pthread_t worker;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int wake[2]; // the worker writes a byte here when a diff is done
+
+    // the request, swapped over to the worker
+    int posted;
+    int reload; // read the blob again first
+    char path[1024];
+    uint32_t *lines;
+    int numLines, linesCap;
+
+    // the result, swapped over to the main thread
+    int done;
+    int doneTracked;
+    unsigned char *result;
+    int numResult, resultCap;
+
+    // what's being drawn
+    unsigned char *marks;
+    int numMarks, marksCap;
+
+    int seenDirty; // E.dirty when it was last looked at
+    uint64_t due; // when the rows get diffed, 0 if they don't need to be
+};
+
+struct gutterState G = { .lock = PTHREAD_MUTEX_INITIALIZER, .cond = PTHREAD_COND_INITIALIZER };
+
+int gutterWidth() {
+    return G.tracked && !J.showing ? GUTTER_WIDTH : 0;
+}
+
+uint32_t gutterHashLine(const char *s, int len) {
+    if(len > 0 && s[len - 1] == '\r') len--;
+    return hashBytes(s, len);
+}
+
+// hashes of the lines of the file's blob in the index, returns -1 if it isn't in one
+int gutterLoadBase(const char *path, uint32_t **base, int *numBase, int *cap) {
+    char dir[1024], spec[1100];
+    const char *slash = strrchr(path, '/');
+    if(slash) snprintf(dir, sizeof(dir), "%.*s", (int)(slash - path), path);
+    else snprintf(dir, sizeof(dir), ".");
+    if(slash && slash == path) snprintf(dir, sizeof(dir), "/");
+    snprintf(spec, sizeof(spec), ":./%s", slash ? slash + 1 : path);
+
+    int fds[2];
+    if(pipe(fds) == -1) return -1;
+    pid_t pid = fork();
+    if(pid == -1) {
+        close(fds[0]);
+        close(fds[1]);
+        return -1;
+    }
+    if(pid == 0) {
+        int null = open("/dev/null", O_RDWR);
+        dup2(null, STDIN_FILENO);
+        dup2(fds[1], STDOUT_FILENO);
+        dup2(null, STDERR_FILENO);
+        close(fds[0]);
+        close(fds[1]);
+        execlp("git", "git", "-C", dir, "cat-file", "blob", spec, (char *)NULL);
+        _exit(127);
+    }
+    close(fds[1]);
+
+    char *blob = NULL;
+    int len = 0, blobCap = 0;
+    ssize_t n;
+    do {
+        blob = editorReserve(blob, &blobCap, len + 65536);
+        n = read(fds[0], blob + len, blobCap - len);
+        if(n > 0) len += n;
+    } while(n > 0 || (n == -1 && errno == EINTR));
+    close(fds[0]);
+    int status;
+    while(waitpid(pid, &status, 0) == -1 && errno == EINTR);
+    if(!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        free(blob);
+        return -1;
+    }
+
+    *numBase = 0;
+    for(int at = 0; at < len;) {
+        char *nl = memchr(blob + at, '\n', len - at);
+        int end = nl ? nl - blob : len;
+        *base = editorReserve(*base, cap, sizeof(uint32_t) * (*numBase + 1));
+        (*base)[(*numBase)++] = gutterHashLine(blob + at, end - at);
+        at = end + 1;
+    }
+    free(blob);
+    return 0;
+}
+
+// mark lines of b that aren't in a. the common start and end are skipped, then the
+// middle is diffed with myers' algorithm keeping each round's furthest reaching paths
+// to walk back through. deletions are counted at the line of b they happened before
+void gutterDiff(const uint32_t *a, int na, const uint32_t *b, int nb, unsigned char *marks) {
+    memset(marks, GUTTER_NONE, nb);
+    int total = nb;
+    int pre = 0, suf = 0;
+    while(pre < na && pre < nb && a[pre] == b[pre]) pre++;
+    while(suf < na - pre && suf < nb - pre && a[na - 1 - suf] == b[nb - 1 - suf]) suf++;
+    a += pre;
+    b += pre;
+    na -= pre + suf;
+    nb -= pre + suf;
+    if(na == 0 && nb == 0) return;
+
+    // ins[y] says b[y] was inserted, del[y] how many lines of a were deleted before it
+    unsigned char *ins = calloc(nb + 1, 1);
+    int *del = calloc(nb + 1, sizeof(int));
+    int *trace = NULL;
+    int traceCap = 0, d, found = 0;
+    for(d = 0; d <= GUTTER_MAX_EDITS && !found; d++) {
+        // round d keeps x for diagonals k = -d, -d + 2 .. d at index (k + d) / 2
+        int round = d * (d + 1) / 2;
+        trace = editorReserve(trace, &traceCap, sizeof(int) * (round + d + 1));
+        int *v = &trace[round], *prev = &trace[round - d];
+        for(int k = -d; k <= d; k += 2) {
+            int x;
+            if(d == 0) x = 0;
+            else if(k == -d || (k != d && prev[(k - 1 + d - 1) / 2] < prev[(k + 1 + d - 1) / 2])) x = prev[(k + 1 + d - 1) / 2];
+            else x = prev[(k - 1 + d - 1) / 2] + 1;
+            int y = x - k;
+            while(x < na && y < nb && a[x] == b[y]) {
+                x++;
+                y++;
+            }
+            v[(k + d) / 2] = x;
+            if(x >= na && y >= nb) found = 1;
+        }
+    }
+
+    if(found) {
+        int x = na, y = nb;
+        for(d = d - 1; d > 0; d--) {
+            int *prev = &trace[(d - 1) * d / 2];
+            int k = x - y, prevK;
+            if(k == -d || (k != d && prev[(k - 1 + d - 1) / 2] < prev[(k + 1 + d - 1) / 2])) prevK = k + 1;
+            else prevK = k - 1;
+            int prevX = prev[(prevK + d - 1) / 2], prevY = prevX - prevK;
+            if(prevK == k + 1) ins[prevY] = 1;
+            else del[prevY]++;
+            x = prevX;
+            y = prevY;
+        }
+    } else {
+        // too different to be worth it, the whole middle changed
+        for(int y = 0; y < nb; y++) ins[y] = 1;
+        del[0] = na;
+    }
+
+    // inserted lines replace deleted ones before them where there are any
+    int pending = 0;
+    for(int y = 0; y <= nb; y++) {
+        pending += del[y];
+        if(y < nb && ins[y]) {
+            marks[pre + y] = pending > 0 ? GUTTER_MODIFIED : GUTTER_ADDED;
+            if(pending > 0) pending--;
+        } else if(pending > 0 && total > 0) {
+            int at = pre + y < total ? pre + y : total - 1;
+            if(marks[at] == GUTTER_NONE) marks[at] = GUTTER_DELETED;
+            pending = 0;
+        }
+    }
+    free(ins);
+    free(del);
+    free(trace);
+}
 
-        if(cur_rx > rx) return cx;
+void *gutterWorker(void *arg) {
+    (void)arg;
+    uint32_t *base = NULL, *lines = NULL;
+    int numBase = 0, baseCap = 0, numLines = 0, linesCap = 0, tracked = 0;
+    unsigned char *result = NULL;
+    int resultCap = 0;
+    char path[1024];
+
+    pthread_mutex_lock(&G.lock);
+    while(1) {
+        while(!G.posted) pthread_cond_wait(&G.cond, &G.lock);
+        // take the request, leaving the last one's buffer to be filled next time
+        uint32_t *swap = G.lines;
+        G.lines = lines;
+        lines = swap;
+        int cap = G.linesCap;
+        G.linesCap = linesCap;
+        linesCap = cap;
+        numLines = G.numLines;
+        int reload = G.reload;
+        memcpy(path, G.path, sizeof(path));
+        G.posted = 0;
+        G.reload = 0;
+        pthread_mutex_unlock(&G.lock);
+
+        if(reload) tracked = gutterLoadBase(path, &base, &numBase, &baseCap) == 0;
+        result = editorReserve(result, &resultCap, numLines + 1);
+        if(tracked) gutterDiff(base, numBase, lines, numLines, result);
+
+        pthread_mutex_lock(&G.lock);
+        unsigned char *out = G.result;
+        G.result = result;
+        result = out;
+        cap = G.resultCap;
+        G.resultCap = resultCap;
+        resultCap = cap;
+        G.numResult = tracked ? numLines : 0;
+        G.doneTracked = tracked;
+        G.done = 1;
+        write(G.wake[1], "", 1);
     }
-    return cx; // just in case caller provided a rx that is out of range
+    return NULL;
 }
 
-// use the chars string of an erow to fill the contents of the render string
-void editorUpdateRow(erow *row) {
-    int tabs = 0;
-    int j;
-    // render tabs as multiple space characters
-    for(j = 0; j < row->size; j++) {
-        if(row->chars[j] == '\t') tabs++;
+// hand the rows' hashes to the worker
+void gutterPost(int reload) {
+    pthread_mutex_lock(&G.lock);
+    G.lines = editorReserve(G.lines, &G.linesCap, sizeof(uint32_t) * (E.numRows + 1));
+    for(int j = 0; j < E.numRows; j++) {
+        erow *row = &E.row[j];
+        if(!row->lineHashValid) {
+            row->lineHash = gutterHashLine(row->chars, row->size);
+            row->lineHashValid = 1;
+        }
+        G.lines[j] = row->lineHash;
     }
+    G.numLines = E.numRows;
+    G.reload |= reload;
+    G.posted = 1;
+    pthread_cond_signal(&G.cond);
+    pthread_mutex_unlock(&G.lock);
+    G.due = 0;
+}
 
-    free(row->render);
-    row->render = malloc(row->size + tabs*(CACTUS_TAB_STOP - 1) + 1);
+// the file was opened or saved, compare with the index again
+void gutterReload() {
+    if(B.running || J.showing || !E.filename) return;
+    if(!G.enabled) {
+        if(pipe(G.wake) == -1) return;
+        fcntl(G.wake[0], F_SETFL, O_NONBLOCK);
+        fcntl(G.wake[0], F_SETFD, FD_CLOEXEC);
+        fcntl(G.wake[1], F_SETFD, FD_CLOEXEC);
+        if(pthread_create(&G.worker, NULL, gutterWorker, NULL) != 0) return;
+        G.enabled = 1;
+    }
+    pthread_mutex_lock(&G.lock);
+    snprintf(G.path, sizeof(G.path), "%s", E.filename);
+    pthread_mutex_unlock(&G.lock);
+    G.seenDirty = E.dirty;
+    gutterPost(1);
+}
 
-    int index = 0;
-    for(j = 0; j < row->size; j++) {
-        if(row->chars[j] == '\t') {
-            row->render[index++] = ' ';
-            // max # of chars for each tab is 8
-            while(index % CACTUS_TAB_STOP != 0) row->render[index++] = ' ';
-        } else {
-            row->render[index++] = row->chars[j];
-        }
+// take a finished diff, returns 1 if there was one
+int gutterCollect() {
+    char drain[64];
+    while(read(G.wake[0], drain, sizeof(drain)) > 0);
+    pthread_mutex_lock(&G.lock);
+    int done = G.done;
+    if(done) {
+        unsigned char *swap = G.marks;
+        G.marks = G.result;
+        G.result = swap;
+        int cap = G.marksCap;
+        G.marksCap = G.resultCap;
+        G.resultCap = cap;
+        G.numMarks = G.numResult;
+        G.tracked = G.doneTracked;
+        G.done = 0;
     }
-    row->render[index] = '\0';
-    row->rsize = index;
+    pthread_mutex_unlock(&G.lock);
+    return done;
+}
 
-    editorUpdateSyntax(row);
+// start the debounce when the file changed, diff when it runs out.
+// returns how many ms until then, -1 if nothing is waiting
+int gutterTick() {
+    if(!G.enabled || J.showing) return -1;
+    uint64_t now = monotonicNs();
+    if(E.dirty != G.seenDirty) {
+        G.seenDirty = E.dirty;
+        G.due = now + GUTTER_DEBOUNCE_NS;
+    }
+    if(!G.due) return -1;
+    if(now >= G.due) {
+        gutterPost(0);
+        return -1;
+    }
+    return (G.due - now) / 1000000 + 1;
 }
 
-void editorInsertRow(int at, char *s, size_t len) {
-    if (at < 0 || at > E.numRows) return;
+/*** spelling ***/
+
+// words in comments and strings are looked up in a dictionary compiled from a word list
+// ($CACTUS_DICT, ~/.cactus/words or /usr/share/dict/words) into ~/.cactus/dict.cache, which
+// is mapped like the syntax cache. a bloom filter turns most misspelled words away, the rest
+// go through a minimal perfect hash (hash and displace) to the one word they could be.
+// rows on screen are checked once typing pauses. their misspelled spans are kept in a
+// small cache of the rows on screen, in slot row & (cacheCap - 1), until they are
+// highlighted again
+
+#define DICT_CACHE_MAGIC "CACDIC01"
+#define SPELL_MAX_WORD 32
+#define SPELL_BLOOM_K 5
+#define SPELL_DELAY_NS 200000000
+
+struct dictHeader {
+    char magic[8];
+    uint64_t fingerprint; // of the word list's path, size and mtime
+    uint32_t size;
+    uint32_t numWords;
+    uint32_t seed;
+    uint32_t numBuckets;
+    uint32_t bloomMask; // bits in the filter - 1
+    uint32_t bloomOff; // uint64_t bloom[(bloomMask + 1) / 64]
+    uint32_t dispOff; // uint32_t disp[numBuckets], each bucket's displacement
+    uint32_t slotOff; // uint32_t slots[numWords], offset of the word in each slot
+};
 
-    // allocate space for a new erow and then copy the given string to a new erow at the end of E.row array
-    E.row = realloc(E.row, sizeof(erow) * (E.numRows + 1));
-    memmove(&E.row[at + 1], &E.row[at], sizeof(erow) * (E.numRows - at));
-    for(int j = at + 1; j <= E.numRows; j++) E.row[j].idx++;
+struct spellState {
+    const char *table;
+    size_t size;
+    int mapped;
+    const struct dictHeader *h;
+    const uint64_t *bloom;
+    const uint32_t *disp;
+    const uint32_t *slots;
+    struct spellRow *cache; // cacheCap entries, a power of two at least the screen's rows
+    int cacheCap;
+};
 
-    E.row[at].idx = at; // row's index in the file at the time it is inserted
+// the misspelled words of one checked row
+struct spellRow {
+    int row; // -1 for none
+    struct spellSpan *spans;
+    int numSpans, spanCap;
+};
 
-    E.row[at].size = len;
-    E.row[at].chars = malloc(len + 1);
-    memcpy(E.row[at].chars, s, len);
-    E.row[at].chars[len] = '\0';
+struct spellState SP;
 
-    E.row[at].rsize = 0;
-    E.row[at].render = NULL;
-    E.row[at].hl = NULL;
-    E.row[at].hl_open_comment = 0;
-    editorUpdateRow(&E.row[at]);
+// the checked row `at`, NULL if it hasn't been checked since it changed
+struct spellRow *spellFind(int at) {
+    if(!SP.cacheCap) return NULL;
+    struct spellRow *c = &SP.cache[at & (SP.cacheCap - 1)];
+    return c->row == at ? c : NULL;
+}
 
-    E.numRows++;
-    E.dirty++;
+// make room for every row on screen, what was checked is checked again after a resize
+void spellCacheFit() {
+    if(SP.cacheCap >= E.screenRows) return;
+    for(int i = 0; i < SP.cacheCap; i++) free(SP.cache[i].spans);
+    int cap = 64;
+    while(cap < E.screenRows) cap *= 2;
+    SP.cache = realloc(SP.cache, sizeof(struct spellRow) * cap);
+    for(int i = 0; i < cap; i++) SP.cache[i] = (struct spellRow){ -1, NULL, 0, 0 };
+    SP.cacheCap = cap;
 }
 
-// free memory owned by the erow
-void editorFreeRow(erow *row) {
-    free(row->render);
-    free(row->chars);
-    free(row->hl);
+void spellRowChanged(erow *row) {
+    if(J.showing) return;
+    struct spellRow *c = spellFind(editorRowIndex(row));
+    if(c) c->row = -1;
 }
 
-void editorDelRow(int at) {
-    if (at < 0 || at >= E.numRows) return;
-    editorFreeRow(&E.row[at]);
-    // overwrite the deleted row struct with the rest of the rows that come after it
-    memmove(&E.row[at], &E.row[at + 1], sizeof(erow) * (E.numRows - at - 1));
-    for(int j = at; j < E.numRows - 1; j++) E.row[j].idx--;
-    E.numRows--;
-    E.dirty++;
+// n rows were inserted at `at`, or -n deleted. the rows after move and so do their slots,
+// entries are swapped into place taking their spans along
+void spellRowsMoved(int at, int n) {
+    if(J.showing) return;
+    int mask = SP.cacheCap - 1;
+    for(int i = 0; i < SP.cacheCap; i++) {
+        struct spellRow *c = &SP.cache[i];
+        if(c->row < at) continue;
+        c->row = n < 0 && c->row < at - n ? -1 : c->row + n;
+    }
+    for(int i = 0; i < SP.cacheCap; i++) {
+        while(SP.cache[i].row != -1 && (SP.cache[i].row & mask) != i) {
+            struct spellRow *home = &SP.cache[SP.cache[i].row & mask];
+            if(home->row != -1 && (home->row & mask) == home - SP.cache) {
+                // rows a multiple of the cache apart, one has to go
+                SP.cache[i].row = -1;
+                break;
+            }
+            struct spellRow t = *home;
+            *home = SP.cache[i];
+            SP.cache[i] = t;
+        }
+    }
 }
 
-void editorRowInsertChar(erow *row, int at, int c) {
-    // validate the index we want to insert the character into
-    if(at < 0 || at > row->size) at = row->size;
-    // allocate one more byte for the chars of the erow
-    // add 2 because we need to also make room for the null byte
-    row->chars = realloc(row->chars, row->size + 2);
-    // make room for the new character
-    memmove(&row->chars[at + 1], &row->chars[at], row->size -at + 1);
-    // increase the size of the chars array
-    row->size++;
-    // assign the character to its position in the array
-    row->chars[at] = c;
-    // update render and rsize with the new row content
-    editorUpdateRow(row);
-    E.dirty++;
+uint64_t spellHash(const char *w, int len, uint32_t seed) {
+    uint64_t h = hashBytes64(14695981039346656037ULL ^ seed, w, len);
+    // fnv's low bits are weak, mix them
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
 }
 
-// append a string to the end of a row
-void editorRowAppendString(erow *row, char *s, size_t len) {
-    row->chars = realloc(row->chars, row->size + len + 1);
-    memcpy(&row->chars[row->size], s, len);
-    row->size += len;
-    row->chars[row->size] = '\0';
-    editorUpdateRow(row);
-    E.dirty++;
+uint32_t spellSlot(uint64_t h, uint32_t d, uint32_t numWords) {
+    return ((uint32_t)h + d * ((uint32_t)(h >> 16) | 1)) % numWords;
 }
 
-// deletes a character in an erow
-void editorRowDelChar(erow *row, int at) {
-    if (at < 0 || at >= row->size) return;
-    // overwrite the deleted character with the characters that come after it2
-    memmove(&row->chars[at], &row->chars[at + 1], row->size - at);
-    row->size--;
-    editorUpdateRow(row);
-    E.dirty++;
+int dictCompareWords(const void *a, const void *b) {
+    return strcmp(*(char * const *)a, *(char * const *)b);
 }
 
-/*** editor operations ***/
+// compile the words, one per line, into a table. returns NULL if there are none
+char *dictCompile(char *list, size_t listLen, uint64_t fingerprint, size_t *size) {
+    // lowercase words of letters and apostrophes, sorted so duplicates are dropped
+    char **words = NULL;
+    int numWords = 0, wordsCap = 0;
+    size_t poolLen = 0;
+    for(size_t at = 0; at < listLen;) {
+        char *line = list + at;
+        char *nl = memchr(line, '\n', listLen - at);
+        size_t len = nl ? (size_t)(nl - line) : listLen - at;
+        at += len + 1;
+        if(len > 0 && line[len - 1] == '\r') len--;
+        if(len == 0 || len > SPELL_MAX_WORD) continue;
+        size_t i;
+        for(i = 0; i < len && (isalpha((unsigned char)line[i]) || line[i] == '\''); i++)
+            line[i] = tolower((unsigned char)line[i]);
+        if(i < len) continue;
+        line[len] = '\0';
+        words = editorReserve(words, &wordsCap, sizeof(char *) * (numWords + 1));
+        words[numWords++] = line;
+    }
+    qsort(words, numWords, sizeof(char *), dictCompareWords);
+    int n = 0;
+    for(int i = 0; i < numWords; i++) {
+        if(n > 0 && !strcmp(words[n - 1], words[i])) continue;
+        words[n++] = words[i];
+        poolLen += strlen(words[i]) + 1;
+    }
+    if(n == 0) {
+        free(words);
+        return NULL;
+    }
 
-// take a character and use editorRowInsertChar() to insert that character
-// into a position the cursor is at
-void editorInsertChar(int c) {
-    if(E.cy == E.numRows) {
-        // cursor is on the tilde line after the end of the file
-        // so append a new row to the file before inserting character
-        editorInsertRow(E.numRows, "", 0);
+    uint32_t numBuckets = n / 4 + 1;
+    uint32_t bloomBits = 64;
+    while(bloomBits < (uint32_t)n * 10) bloomBits <<= 1;
+    uint32_t bloomOff = sizeof(struct dictHeader);
+    uint32_t dispOff = bloomOff + bloomBits / 8;
+    uint32_t slotOff = dispOff + numBuckets * sizeof(uint32_t);
+    uint32_t pool = slotOff + n * sizeof(uint32_t);
+    *size = pool + poolLen;
+    char *table = calloc(1, *size);
+
+    uint32_t *wordOff = malloc(sizeof(uint32_t) * n);
+    uint32_t off = pool;
+    for(int i = 0; i < n; i++) {
+        wordOff[i] = off;
+        off += strlen(words[i]) + 1;
+        memcpy(table + wordOff[i], words[i], off - wordOff[i]);
     }
 
-    // move cursor forward so next character the user inserts
-    // will go after the character just inserted
-    editorRowInsertChar(&E.row[E.cy], E.cx, c);
-    E.cx++;
-}
+    // hash and displace: buckets are placed biggest first, each trying displacements
+    // until all its words land in free slots. if one can't, start over with another seed
+    uint64_t *hashes = malloc(sizeof(uint64_t) * n);
+    uint32_t *bucketOf = malloc(sizeof(uint32_t) * n);
+    uint32_t *order = malloc(sizeof(uint32_t) * n);
+    uint32_t *start = malloc(sizeof(uint32_t) * (numBuckets + 1));
+    uint32_t *byBucket = malloc(sizeof(uint32_t) * numBuckets);
+    uint32_t *disp = (uint32_t *)(table + dispOff);
+    uint32_t *slots = (uint32_t *)(table + slotOff);
+    unsigned char *used = malloc(n);
+    uint32_t seed;
+    for(seed = 0;; seed++) {
+        memset(start, 0, sizeof(uint32_t) * (numBuckets + 1));
+        for(int i = 0; i < n; i++) {
+            hashes[i] = spellHash(words[i], strlen(words[i]), seed);
+            bucketOf[i] = (uint32_t)(hashes[i] >> 32) % numBuckets;
+            start[bucketOf[i] + 1]++;
+        }
+        for(uint32_t b = 0; b < numBuckets; b++) start[b + 1] += start[b];
+        uint32_t *fill = malloc(sizeof(uint32_t) * numBuckets);
+        memcpy(fill, start, sizeof(uint32_t) * numBuckets);
+        for(int i = 0; i < n; i++) order[fill[bucketOf[i]]++] = i;
+        free(fill);
+
+        // counting sort of the buckets by size, biggest first
+        uint32_t biggest = 0;
+        for(uint32_t b = 0; b < numBuckets; b++)
+            if(start[b + 1] - start[b] > biggest) biggest = start[b + 1] - start[b];
+        uint32_t k = 0;
+        for(uint32_t s = biggest; s > 0; s--)
+            for(uint32_t b = 0; b < numBuckets; b++) if(start[b + 1] - start[b] == s) byBucket[k++] = b;
+
+        memset(used, 0, n);
+        memset(disp, 0, sizeof(uint32_t) * numBuckets);
+        int ok = 1;
+        for(uint32_t i = 0; i < k && ok; i++) {
+            uint32_t b = byBucket[i], d;
+            for(d = 0; d < (1 << 20); d++) {
+                uint32_t j;
+                for(j = start[b]; j < start[b + 1]; j++) {
+                    uint32_t slot = spellSlot(hashes[order[j]], d, n);
+                    if(used[slot]) break;
+                    used[slot] = 2; // taken by this bucket while trying
+                }
+                if(j == start[b + 1]) break;
+                for(uint32_t u = start[b]; u < j; u++) used[spellSlot(hashes[order[u]], d, n)] = 0;
+            }
+            if(d == (1 << 20)) {
+                ok = 0;
+                break;
+            }
+            disp[b] = d;
+            for(uint32_t j = start[b]; j < start[b + 1]; j++) {
+                uint32_t slot = spellSlot(hashes[order[j]], d, n);
+                used[slot] = 1;
+                slots[slot] = wordOff[order[j]];
+            }
+        }
+        if(ok) break;
+    }
 
-// handle 'enter' keypress
-void editorInsertNewLine() {
-    if(E.cx == 0) {
-        editorInsertRow(E.cy, "", 0);
-    } else {
-        erow *row = &E.row[E.cy];
-        editorInsertRow(E.cy + 1, &row->chars[E.cx], row->size - E.cx);
-        row = &E.row[E.cy];
-        row->size = E.cx;
-        row->chars[row->size] = '\0';
-        editorUpdateRow(row);
+    uint64_t *bloom = (uint64_t *)(table + bloomOff);
+    for(int i = 0; i < n; i++) {
+        uint32_t h1 = (uint32_t)hashes[i], h2 = (uint32_t)(hashes[i] >> 32) | 1;
+        for(int j = 0; j < SPELL_BLOOM_K; j++) {
+            uint32_t bit = (h1 + j * h2) & (bloomBits - 1);
+            bloom[bit >> 6] |= 1ULL << (bit & 63);
+        }
     }
-    E.cy++;
-    E.cx = 0;
+
+    struct dictHeader *h = (struct dictHeader *)table;
+    memcpy(h->magic, DICT_CACHE_MAGIC, 8);
+    h->fingerprint = fingerprint;
+    h->size = *size;
+    h->numWords = n;
+    h->seed = seed;
+    h->numBuckets = numBuckets;
+    h->bloomMask = bloomBits - 1;
+    h->bloomOff = bloomOff;
+    h->dispOff = dispOff;
+    h->slotOff = slotOff;
+
+    free(words);
+    free(wordOff);
+    free(hashes);
+    free(bucketOf);
+    free(order);
+    free(start);
+    free(byBucket);
+    free(used);
+    return table;
 }
 
-// delete the character that is to the left of the cursor
-void editorDelChar() {
-    // if cursor is past the end of the file, nothing to delete
-    if(E.cy == E.numRows) return;
-    if(E.cx == 0 && E.cy == 0) return;
+int dictAttach(const char *table, size_t size, int mapped) {
+    const struct dictHeader *h = (const struct dictHeader *)table;
+    if(size < sizeof(*h) || memcmp(h->magic, DICT_CACHE_MAGIC, 8) || h->size != size || h->numWords == 0) return -1;
+    // lookups divide by numBuckets and index the filter in whole words
+    size_t bloomBits = (size_t)h->bloomMask + 1;
+    if(h->numBuckets == 0 || bloomBits < 64 || (bloomBits & (bloomBits - 1)) ||
+        h->bloomOff % sizeof(uint64_t) || h->dispOff % sizeof(uint32_t) || h->slotOff % sizeof(uint32_t)) return -1;
+    if(h->bloomOff + ((size_t)h->bloomMask + 1) / 8 > size ||
+        h->dispOff + (size_t)h->numBuckets * sizeof(uint32_t) > size ||
+        h->slotOff + (size_t)h->numWords * sizeof(uint32_t) > size) return -1;
+    SP.table = table;
+    SP.size = size;
+    SP.mapped = mapped;
+    SP.h = h;
+    SP.bloom = (const uint64_t *)(table + h->bloomOff);
+    SP.disp = (const uint32_t *)(table + h->dispOff);
+    SP.slots = (const uint32_t *)(table + h->slotOff);
+    return 0;
+}
 
-    erow *row = &E.row[E.cy];
-    // if there is a character to the left of the cursor, delete and move cursor one to the left
-    if(E.cx > 0) {
-        editorRowDelChar(row, E.cx - 1);
-        E.cx--;
-    } else {
-        E.cx = E.row[E.cy - 1].size;
-        editorRowAppendString(&E.row[E.cy - 1], row->chars, row->size);
-        editorDelRow(E.cy);
-        E.cy--;
+// load the dictionary, from the compiled cache if it's still valid. without a word list there's no spell checking
+void spellLoadDict() {
+    if(B.running) return;
+    char list[1024], cache[1024];
+    char *env = getenv("CACTUS_DICT");
+    struct stat st;
+    if(env) snprintf(list, sizeof(list), "%s", env);
+    else if(editorDataPath(list, sizeof(list), "words") == -1 || stat(list, &st) == -1)
+        snprintf(list, sizeof(list), "/usr/share/dict/words");
+    if(stat(list, &st) == -1) return;
+    if(editorDataPath(cache, sizeof(cache), "dict.cache") == -1) cache[0] = '\0';
+
+    uint64_t fingerprint = hashBytes64(14695981039346656037ULL, list, strlen(list));
+    fingerprint = hashBytes64(fingerprint, &st.st_size, sizeof(st.st_size));
+    fingerprint = hashBytes64(fingerprint, &st.st_mtime, sizeof(st.st_mtime));
+
+    int fd = cache[0] ? open(cache, O_RDONLY) : -1;
+    if(fd != -1) {
+        struct stat cst;
+        if(fstat(fd, &cst) == 0 && cst.st_size >= (off_t)sizeof(struct dictHeader)) {
+            char *map = mmap(NULL, cst.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if(map != MAP_FAILED) {
+                if(((struct dictHeader *)map)->fingerprint == fingerprint && dictAttach(map, cst.st_size, 1) == 0) {
+                    close(fd);
+                    return;
+                }
+                munmap(map, cst.st_size);
+            }
+        }
+        close(fd);
     }
-}
 
-/*** file i/o ***/
+    FILE *fp = fopen(list, "r");
+    if(!fp) return;
+    char *words = malloc(st.st_size + 1);
+    size_t len = fread(words, 1, st.st_size, fp);
+    fclose(fp);
+    size_t size;
+    char *table = dictCompile(words, len, fingerprint, &size);
+    free(words);
+    if(!table) return;
+    if(cache[0]) syntaxWriteCache(cache, table, size);
+    if(dictAttach(table, size, 0) == -1) free(table);
+}
 
-// convert array of erow structs into a string strings that writes out to a file
-char *editorRowsToString(int *buffLen) {
-    int totLen = 0;
-    int j;
-    for(j = 0; j < E.numRows; j++) {
-        // add up the lengths of each row of text
-        // add 1 to each one for the newline char we add to the end of each line
-        totLen += E.row[j].size + 1;
-    }
-    // save the total length into buffLen
-    *buffLen = totLen;
+int spellKnown(const char *w, int len) {
+    char lower[SPELL_MAX_WORD];
+    for(int i = 0; i < len; i++) lower[i] = tolower((unsigned char)w[i]);
+    uint64_t h = spellHash(lower, len, SP.h->seed);
 
-    char *buf = malloc(totLen);
-    char *p = buf;
-    // loop through the rows
-    for(j = 0; j < E.numRows; j++) {
-        memcpy(p, E.row[j].chars, E.row[j].size);
-        p += E.row[j].size;
-        *p = '\n'; // append newline character after each row
-        p++;
+    // most misspellings stop at the filter
+    uint32_t h1 = (uint32_t)h, h2 = (uint32_t)(h >> 32) | 1;
+    for(int j = 0; j < SPELL_BLOOM_K; j++) {
+        uint32_t bit = (h1 + j * h2) & SP.h->bloomMask;
+        if(!(SP.bloom[bit >> 6] & (1ULL << (bit & 63)))) return 0;
     }
-
-    return buf;
+    uint32_t d = SP.disp[(uint32_t)(h >> 32) % SP.h->numBuckets];
+    uint32_t off = SP.slots[spellSlot(h, d, SP.h->numWords)];
+    if(off >= SP.size || SP.size - off <= (size_t)len) return 0;
+    return !memcmp(SP.table + off, lower, len) && SP.table[off + len] == '\0';
 }
 
-// open and read file from disk
-void editorOpen(char *filename) {
-    free(E.filename);
-    E.filename = strdup(filename);
-
-    editorSelectSyntaxHighlight();
+int spellActive() {
+    return SP.table && E.syntax && !J.showing;
+}
 
-    // read and display the first line of the file
-    FILE *fp = fopen(filename, "r");
-    if (!fp) die("fopen");
+int spellInText(unsigned char hl) {
+    return hl == HL_COMMENT || hl == HL_MULTI_LINE_COMMENT || hl == HL_STRING;
+}
 
-    char *line = NULL;
-    ssize_t linecap = 0;
-    ssize_t linelen;
-    linelen = getline(&line, &linecap, fp);
-    // read entire file into E.row
-    while((linelen = getline(&line, &linecap, fp)) != -1) {
-        while(linelen > 0 && (line[linelen -1] == '\n' || line[linelen - 1] == '\r'))
-        linelen--;
-        editorInsertRow(E.numRows, line, linelen);
+// find the misspelled words of a row. words that look like code (next to digits,
+// underscores, dots or slashes, or with capitals after the first letter) are left alone
+struct spellRow *spellCheckRow(int at) {
+    erow *row = &E.row[at];
+    struct spellRow *c = &SP.cache[at & (SP.cacheCap - 1)];
+    const char *r = row->render;
+    int n = row->rsize;
+    c->row = at;
+    c->numSpans = 0;
+    for(int j = 0; j < n;) {
+        if(!spellInText(row->hl[j]) || !isalpha((unsigned char)r[j])) {
+            j++;
+            continue;
+        }
+        int start = j, caps = 0;
+        while(j < n && (isalpha((unsigned char)r[j]) ||
+            (r[j] == '\'' && j + 1 < n && isalpha((unsigned char)r[j + 1])))) {
+            if(j > start && isupper((unsigned char)r[j])) caps = 1;
+            j++;
+        }
+        int len = j - start;
+        // possessives are checked without the 's
+        if(len > 2 && r[j - 2] == '\'' && tolower((unsigned char)r[j - 1]) == 's') len -= 2;
+        if(caps || len < 2 || len > SPELL_MAX_WORD || !spellInText(row->hl[j - 1])) continue;
+        if(start > 0 && strchr("0123456789_./\\#$%@&", r[start - 1])) continue;
+        if(j < n && (isdigit((unsigned char)r[j]) || r[j] == '_' || r[j] == '(' ||
+            ((r[j] == '.' || r[j] == '/') && j + 1 < n && isalnum((unsigned char)r[j + 1])))) continue;
+        if(spellKnown(&r[start], len)) continue;
+        c->spans = editorReserve(c->spans, &c->spanCap, sizeof(struct spellSpan) * (c->numSpans + 1));
+        c->spans[c->numSpans++] = (struct spellSpan){ start, j - start };
     }
-    free(line);
-    fclose(fp);
-    E.dirty = 0;
+    return c;
 }
 
-// write the string returned by editorRowsToString() to disk
-void editorSave() {
-    // if a new file, filename is null
-    if (E.filename == NULL) {
-        E.filename = editorPrompt("Save as: %s (ESC to cancel)", NULL);
-        if (E.filename == NULL) {
-            editorSetStatusMessage("Save aborted");
-            return;
-        }
-        editorSelectSyntaxHighlight();
+// a row on screen hasn't been checked since it changed
+int spellPending() {
+    if(!spellActive()) return 0;
+    spellCacheFit();
+    for(int y = E.rowOff; y < E.rowOff + E.screenRows && y < E.numRows; y++)
+        if(!spellFind(y)) return 1;
+    return 0;
+}
+
+// check the rows on screen that changed, returns 1 if the underlines need drawing
+int spellCheckVisible() {
+    int changed = 0;
+    spellCacheFit();
+    for(int y = E.rowOff; y < E.rowOff + E.screenRows && y < E.numRows; y++) {
+        erow *row = &E.row[y];
+        if(spellFind(y)) continue;
+        if(editorRowStale(row)) editorUpdateSyntax(row);
+        // unchecked rows are drawn without underlines
+        if(spellCheckRow(y)->numSpans) changed = 1;
     }
+    return changed;
+}
 
-    int len;
-    char *buf = editorRowsToString(&len);
+/*** session ***/
+
+#define SESSION_MAGIC "CACSES03"
+
+// snapshot of the file buffer written on quit. everything in it is addressed by byte offsets
+// from the start of the file, so --restore maps it as is and the rows borrow their chars,
+// render and hl straight from the mapping instead of reading and highlighting the file again
+struct sessionHeader {
+    char magic[8];
+    uint64_t size; // bytes in the whole snapshot
+    uint64_t syntaxHash; // of the syntax hl was made with, 0 for none
+    uint64_t hlCacheHash; // content hash of the file as last opened or saved, 0 if never
+    int64_t diskSize, diskMtime; // and its size and mtime, checked on restore
+    uint64_t nameOff; // NUL terminated filename, 0 when the buffer has none
+    uint64_t textOff; // struct etext holding the chars of every row
+    uint64_t rowsOff; // numRows struct sessionRow
+    uint32_t numRows;
+    uint32_t tabStop;
+    int32_t cx, cy, rowOff, colOff;
+    int32_t dirty, markSet, markX, markY;
+};
 
-    // create a new file if it doesn't already exist and open it for reading and writing
-    // 0644 is the standard permission for text files
-    int fd = open(E.filename, O_RDWR | O_CREAT, 0644);
+struct sessionRow {
+    uint64_t chars; // offset into the etext data
+    uint64_t render, hl, defs; // offsets into the snapshot, render is NUL terminated
+    uint64_t identSig;
+    uint32_t size, rsize, hl_state, numDefs; // defs are a 4 byte length and the name each
+    int32_t plain, indentWidth, braceDelta, leadingClosers;
+};
 
-    if(fd != -1) {
-        if(ftruncate(fd, len) != -1) {
-            if(write(fd, buf, len) == len) {
-                close(fd);
-                free(buf);
-                E.dirty = 0;
-                editorSetStatusMessage("%d bytes written to disk.", len);
-                return;
-            }
-        }
-        close(fd);
-    }
+uint64_t sessionAlign(uint64_t off) {
+    return (off + 7) & ~(uint64_t)7;
+}
 
-    free(buf);
-    editorSetStatusMessage("Can't save! I/O error: %s", strerror(errno));
+void sessionPad(FILE *fp, uint64_t n) {
+    while(n--) fputc(0, fp);
 }
 
-/*** find ***/
+// write the file buffer, its cursor and highlighting to ~/.cactus/session
+void sessionSave() {
+    char path[1024], tmp[1100];
+    if(editorDataPath(path, sizeof(path), "session") == -1) return;
+    if(J.showing) jobSwapBuffers();
+    snprintf(tmp, sizeof(tmp), "%s.%d", path, (int)getpid());
+    FILE *fp = fopen(tmp, "w");
+    if(!fp) return;
+
+    char *name = NULL;
+    if(E.filename && (name = realpath(E.filename, NULL)) == NULL) name = strdup(E.filename);
+    uint64_t nameLen = name ? strlen(name) + 1 : 0;
+    uint64_t text = 0, render = 0, hl = 0, defs = 0;
+    int j, i;
+    for(j = 0; j < E.numRows; j++) {
+        erow *row = &E.row[j];
+        if(editorRowStale(row)) editorUpdateSyntax(row);
+        text += row->size;
+        render += row->rsize + 1;
+        hl += row->rsize;
+        for(i = 0; i < row->numDefs; i++) defs += 4 + SY.sym[row->defs[i]].len;
+    }
+
+    struct sessionHeader h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, SESSION_MAGIC, 8);
+    h.syntaxHash = E.syntax ? hlCacheSyntaxHash() : 0;
+    h.hlCacheHash = E.hlCacheHash;
+    h.diskSize = E.diskSize;
+    h.diskMtime = E.diskMtime;
+    h.nameOff = name ? sizeof(h) : 0;
+    h.textOff = sessionAlign(sizeof(h) + nameLen);
+    uint64_t renderOff = h.textOff + sizeof(struct etext) + text;
+    uint64_t hlOff = renderOff + render, defsOff = hlOff + hl;
+    h.rowsOff = sessionAlign(defsOff + defs);
+    h.size = h.rowsOff + sizeof(struct sessionRow) * E.numRows;
+    h.numRows = E.numRows;
+    h.tabStop = CACTUS_TAB_STOP;
+    h.cx = E.cx;
+    h.cy = E.cy;
+    h.rowOff = E.rowOff;
+    h.colOff = E.colOff;
+    h.dirty = E.dirty;
+    h.markSet = E.markSet;
+    h.markX = E.markX;
+    h.markY = E.markY;
+    fwrite(&h, sizeof(h), 1, fp);
+    if(name) fwrite(name, 1, nameLen, fp);
+    sessionPad(fp, h.textOff - sizeof(h) - nameLen);
+
+    struct etext block;
+    memset(&block, 0, sizeof(block));
+    block.len = text;
+    fwrite(&block, sizeof(block), 1, fp);
+    for(j = 0; j < E.numRows; j++) fwrite(E.row[j].chars, 1, E.row[j].size, fp);
+    for(j = 0; j < E.numRows; j++) fwrite(E.row[j].render, 1, E.row[j].rsize + 1, fp);
+    for(j = 0; j < E.numRows; j++) if(E.row[j].rsize) fwrite(E.row[j].hl, 1, E.row[j].rsize, fp);
+    for(j = 0; j < E.numRows; j++) {
+        for(i = 0; i < E.row[j].numDefs; i++) {
+            struct symbol *sym = &SY.sym[E.row[j].defs[i]];
+            uint32_t len = sym->len;
+            fwrite(&len, 4, 1, fp);
+            fwrite(sym->name, 1, len, fp);
+        }
+    }
+    sessionPad(fp, h.rowsOff - defsOff - defs);
 
-void editorFindCallback(char *query, int key) {
-    static int lastMatch = -1; // index of the row the last match was on
-    static int direction = 1; // direction of search; 1 - forward; -1 - backward
+    text = 0;
+    for(j = 0; j < E.numRows; j++) {
+        erow *row = &E.row[j];
+        struct sessionRow r = {
+            text, renderOff, hlOff, defsOff, row->identSig,
+            row->size, row->rsize, row->hl_state, row->numDefs,
+            row->plain, row->indentWidth, row->braceDelta, row->leadingClosers
+        };
+        fwrite(&r, sizeof(r), 1, fp);
+        text += row->size;
+        renderOff += row->rsize + 1;
+        hlOff += row->rsize;
+        for(i = 0; i < row->numDefs; i++) defsOff += 4 + SY.sym[row->defs[i]].len;
+    }
+    free(name);
 
-    // restore text color after search
-    static int saved_hl_line;
-    static char *saved_hl = NULL;
+    int ok = !ferror(fp);
+    if(fclose(fp) != 0) ok = 0;
+    if(!ok || rename(tmp, path) == -1) unlink(tmp);
+}
 
-    if (saved_hl) {
-        memcpy(E.row[saved_hl_line].hl, saved_hl, E.row[saved_hl_line].rsize);
-        free(saved_hl);
-        saved_hl = NULL;
+// offsets of a row record stay inside the snapshot
+int sessionRowValid(const char *map, uint64_t size, const struct etext *text, const struct sessionRow *r) {
+    if(r->chars > text->len || r->size > text->len - r->chars) return 0;
+    if(r->render >= size || r->rsize >= size - r->render || map[r->render + r->rsize] != '\0') return 0;
+    if(r->hl > size || r->rsize > size - r->hl) return 0;
+    if(r->numDefs > SYMBOL_MAX_ROW_DEFS || r->size > INT32_MAX || r->rsize > INT32_MAX) return 0;
+    uint64_t at = r->defs;
+    for(uint32_t i = 0; i < r->numDefs; i++) {
+        uint32_t len;
+        if(at > size || size - at < 4) return 0;
+        memcpy(&len, map + at, 4);
+        if(len == 0 || len > size - at - 4) return 0;
+        at += 4 + len;
     }
+    return 1;
+}
 
-    // check if user pressed 'enter' or 'escape', if so, leave search mode
-    if (key == '\r' || key == '\x1b') {
-        lastMatch = -1;
-        direction = 1;
-        return;
-    } else if (key == ARROW_RIGHT || key == ARROW_DOWN) {
-        direction = 1;
-    } else if (key == ARROW_LEFT || key == ARROW_UP) {
-        direction = -1;
-    } else {
-        lastMatch = -1;
-        direction = 1;
+// returns 0 if the file is still the version the snapshot was made from, 2 if it was changed
+// and can be read again, 1 if it's gone. a changed mtime alone doesn't count, the contents
+// are hashed to be sure
+int sessionDiskChanged(const char *filename, const struct sessionHeader *h) {
+    struct stat st;
+    int fd = open(filename, O_RDONLY);
+    if(fd == -1) return h->hlCacheHash != 0;
+    if(fstat(fd, &st) == -1 || !S_ISREG(st.st_mode)) {
+        close(fd);
+        return 1;
+    }
+    if(st.st_size == h->diskSize &&
+        (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec == h->diskMtime) {
+        close(fd);
+        return 0;
     }
+    uint64_t hash = 14695981039346656037ULL;
+    char buf[65536];
+    ssize_t n;
+    while((n = read(fd, buf, sizeof(buf))) > 0) hash = hashBytes64(hash, buf, n);
+    close(fd);
+    return n != 0 ? 1 : hash != h->hlCacheHash ? 2 : 0;
+}
 
-    if (lastMatch == -1) direction = 1;
-    int current = lastMatch; // index of the current row wer are searching
+// map the session snapshot into the empty editor, returns 0 if there is none or it's damaged.
+// if the file changed on disk since, a clean buffer is opened from the file again and
+// one with edits is restored marked dirty with a warning
+int sessionRestore() {
+    char path[1024];
+    if(editorDataPath(path, sizeof(path), "session") == -1) return 0;
+    int fd = open(path, O_RDONLY);
+    if(fd == -1) return 0;
+    struct stat st;
+    if(fstat(fd, &st) == -1 || st.st_size < (off_t)sizeof(struct sessionHeader)) {
+        close(fd);
+        return 0;
+    }
+    uint64_t size = st.st_size;
+    // private and writable: the etext reference count and search highlighting write into it
+    char *map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(map == MAP_FAILED) return 0;
+
+    const struct sessionHeader *h = (const struct sessionHeader *)map;
+    int ok = !memcmp(h->magic, SESSION_MAGIC, 8) && h->size == size && h->tabStop == CACTUS_TAB_STOP &&
+        h->textOff % 8 == 0 && h->textOff <= size - sizeof(struct etext) &&
+        h->rowsOff % 8 == 0 && h->rowsOff <= size && h->numRows <= INT32_MAX &&
+        h->numRows <= (size - h->rowsOff) / sizeof(struct sessionRow) &&
+        (h->nameOff == 0 || (h->nameOff < size && memchr(map + h->nameOff, '\0', size - h->nameOff)));
+    struct etext *text = ok ? (struct etext *)(map + h->textOff) : NULL;
+    if(ok && text->len > size - h->textOff - sizeof(struct etext)) ok = 0;
+    const struct sessionRow *rows = (const struct sessionRow *)(map + (ok ? h->rowsOff : 0));
+    for(uint32_t j = 0; ok && j < h->numRows; j++) ok = sessionRowValid(map, size, text, &rows[j]);
+    if(!ok) {
+        munmap(map, size);
+        return 0;
+    }
 
-    // loop through all the rows of the file
-    int i;
-    for(i = 0; i < E.numRows; i++) {
-        current += direction;
-        if (current == -1) current = E.numRows - 1;
-        else if (current == E.numRows) current = 0;
+    int changed = h->nameOff ? sessionDiskChanged(map + h->nameOff, h) : 0;
+    if(changed == 2 && !h->dirty) {
+        struct sessionHeader saved = *h;
+        char *name = strdup(map + h->nameOff);
+        munmap(map, size);
+        editorOpen(name);
+        free(name);
+        E.cy = saved.cy < 0 ? 0 : saved.cy > E.numRows ? E.numRows : saved.cy;
+        E.rowOff = saved.rowOff >= 0 && saved.rowOff <= E.cy ? saved.rowOff : E.cy;
+        editorSetStatusMessage("%s changed on disk since the session, reopened it", E.filename);
+        return 1;
+    }
 
-        erow *row = &E.row[current];
-        // check if query is a substring of the current row
-        char *match = strstr(row->render, query);
-        if(match) {
-            lastMatch = current;
-            E.cy = current;
-            E.cx = editorRowRxToCx(row, match - row->render);
-            E.rowOff = E.numRows;
-
-            saved_hl_line = current;
-            saved_hl = malloc(row->rsize);
-            memcpy(saved_hl, row->hl, row->rsize);
-            memset(&row->hl[match - row->render], HL_MATCH, strlen(query));
-            break;
+    text->refs = 1;
+    text->mapBase = map;
+    text->mapLen = size;
+    free(E.filename);
+    E.filename = h->nameOff ? strdup(map + h->nameOff) : NULL;
+
+    int numRows = h->numRows;
+    editorOpenRows(0, numRows);
+    symbolBulkBegin();
+    for(int j = 0; j < numRows; j++) {
+        const struct sessionRow *r = &rows[j];
+        editorInitRow(j, text, text->data + r->chars, r->size);
+        erow *row = &E.row[j];
+        row->render = map + r->render;
+        row->rsize = r->rsize;
+        row->hl = r->rsize ? (unsigned char *)map + r->hl : NULL;
+        row->hl_state = r->hl_state;
+        row->plain = r->plain;
+        row->identSig = r->identSig;
+        row->indentWidth = r->indentWidth;
+        row->braceDelta = r->braceDelta;
+        row->leadingClosers = r->leadingClosers;
+        row->defs = editorReserve(row->defs, &row->defCap, sizeof(int) * r->numDefs);
+        const char *p = map + r->defs;
+        for(uint32_t i = 0; i < r->numDefs; i++) {
+            uint32_t len;
+            memcpy(&len, p, 4);
+            row->defs[row->numDefs++] = symbolRef(p + 4, len);
+            p += 4 + len;
         }
     }
-}
+    symbolBulkEnd(0);
+    etextRelease(text);
+
+    // the syntax files changed since, the snapshot's highlighting is no good
+    E.syntax = editorDetectSyntax();
+    if((E.syntax ? hlCacheSyntaxHash() : 0) != h->syntaxHash) {
+        symbolBulkBegin();
+        for(int j = 0; j < E.numRows; j++) editorUpdateSyntax(&E.row[j]);
+        symbolBulkEnd(1);
+    }
 
-void editorFind() {
-    int saved_cx = E.cx;
-    int saved_cy = E.cy;
-    int saved_coloff = E.colOff;
-    int saved_rowoff = E.rowOff;
+    E.hlCacheHash = h->hlCacheHash;
+    E.diskSize = h->diskSize;
+    E.diskMtime = h->diskMtime;
+    E.dirty = h->dirty;
+    if(changed && !E.dirty) E.dirty = 1;
+    E.cy = h->cy < 0 ? 0 : h->cy > E.numRows ? E.numRows : h->cy;
+    E.cx = E.cy < E.numRows && h->cx >= 0 && h->cx <= E.row[E.cy].size ? h->cx : 0;
+    E.rowOff = h->rowOff >= 0 && h->rowOff <= E.cy ? h->rowOff : E.cy;
+    E.colOff = h->colOff >= 0 ? h->colOff : 0;
+    E.markSet = h->markSet;
+    E.markX = h->markX;
+    E.markY = h->markY;
+    editorIndentGuess();
+    if(changed) editorSetStatusMessage("WARNING: %s changed on disk since the session, saving overwrites it", E.filename);
+    gutterReload();
+    return 1;
+}
 
-    char *query = editorPrompt("Search: %s (Use ESC/Arrows/Enter)", editorFindCallback);
+/*** idle ***/
+
+// background work runs while no key is pending: a job's output is read, the gutter is
+// diffed once edits settle and rows on screen are spell checked once typing pauses.
+// called before reading a key
+void editorIdle() {
+    uint64_t lastKey = monotonicNs();
+    while(1) {
+        int spellWait = -1;
+        if(spellPending()) {
+            uint64_t quiet = monotonicNs() - lastKey;
+            if(quiet < SPELL_DELAY_NS) spellWait = (SPELL_DELAY_NS - quiet) / 1000000 + 1;
+            else if(spellCheckVisible()) J.redraw = 1;
+        }
+        if(J.redraw && monotonicNs() - J.lastFrame > 50000000) {
+            editorRefreshScreen();
+            J.redraw = 0;
+            J.lastFrame = monotonicNs();
+        }
+        if(J.pid == 0 && !G.enabled && spellWait == -1 && !J.redraw) return;
 
-    if(query) {
-        free(query);
-    } else {
-        E.cx = saved_cx;
-        E.cy = saved_cy;
-        E.colOff = saved_coloff;
-        E.rowOff = saved_rowoff;
+        struct pollfd pfd[3] = { { STDIN_FILENO, POLLIN, 0 } };
+        int n = 1, jobAt = -1, gutterAt = -1;
+        if(J.fd != -1) {
+            pfd[n] = (struct pollfd){ J.fd, POLLIN, 0 };
+            jobAt = n++;
+        }
+        if(G.enabled) {
+            pfd[n] = (struct pollfd){ G.wake[0], POLLIN, 0 };
+            gutterAt = n++;
+        }
+        // redraw at most every 50ms, after the job's pipe closes wait for it to exit
+        int timeout = J.redraw ? 50 : (J.pid > 0 && J.fd == -1 ? 100 : -1);
+        int due = gutterTick();
+        if(due != -1 && (timeout == -1 || due < timeout)) timeout = due;
+        if(spellWait != -1 && (timeout == -1 || spellWait < timeout)) timeout = spellWait;
+
+        if(poll(pfd, n, timeout) == -1 && errno != EINTR) return;
+        if(pfd[0].revents) return;
+        if(jobAt != -1 && pfd[jobAt].revents) jobRead();
+        if(J.pid > 0 && J.fd == -1) jobReap();
+        if(gutterAt != -1 && pfd[gutterAt].revents && gutterCollect()) J.redraw = 1;
     }
 }
 
@@ -802,18 +5708,23 @@ append buffer
 struct abuf {
     char *b;
     int len;
+    int cap;
 };
 
-# define ABUF_INIT {NULL, 0}
+# define ABUF_INIT {NULL, 0, 0}
 
 void abAppend(struct abuf *ab, const char *s, int len) {
-    // allocate enough memory to hold new string
+    // allocate enough memory to hold new string, doubling so appends are amortized
     // realloc() will either extend the size of the block of memory we already have allocated or free it
-    char *new = realloc(ab->b, ab->len + len);
-
-    if (new == NULL) return;
-    memcpy(&new[ab->len], s, len);
-    ab->b = new;
+    if (ab->len + len > ab->cap) {
+        int cap = ab->cap ? ab->cap * 2 : 4096;
+        while (cap < ab->len + len) cap *= 2;
+        char *new = realloc(ab->b, cap);
+        if (new == NULL) return;
+        ab->b = new;
+        ab->cap = cap;
+    }
+    memcpy(&ab->b[ab->len], s, len);
     ab->len += len;
 }
 
@@ -849,14 +5760,19 @@ void editorScroll() {
         E.colOff = E.rx;
     }
 
-    if(E.rx >= E.colOff + E.screenCols) {
-        E.colOff = E.rx - E.screenCols + 1;
+    int textCols = E.screenCols - gutterWidth() - rulerWidth();
+    if(E.rx >= E.colOff + textCols) {
+        E.colOff = E.rx - textCols + 1;
     }
 }
 
 // handle drawing each row of the buffer of text being edited
 // drawing 24 rows for now
 void editorDrawRows(struct abuf *ab) {
+    int x0, y0, x1, y1;
+    int haveSel = editorSelection(&x0, &y0, &x1, &y1);
+    int ruler = rulerWidth();
+    if(ruler) rulerBuild();
     int y;
     for (y = 0; y < E.screenRows; y++) {
         int fileRow = y + E.rowOff;
@@ -881,48 +5797,126 @@ void editorDrawRows(struct abuf *ab) {
                 abAppend(ab, "~", 1);
             }
         } else {
+            if(editorRowStale(&E.row[fileRow])) editorUpdateSyntax(&E.row[fileRow]);
+            int cols = E.screenCols - ruler;
+            if(gutterWidth()) {
+                int mark = fileRow < G.numMarks ? G.marks[fileRow] : GUTTER_NONE;
+                switch(mark) {
+                    case GUTTER_ADDED: abAppend(ab, "\x1b[32m+\x1b[39m ", 12); break;
+                    case GUTTER_MODIFIED: abAppend(ab, "\x1b[33m~\x1b[39m ", 12); break;
+                    case GUTTER_DELETED: abAppend(ab, "\x1b[31m_\x1b[39m ", 12); break;
+                    default: abAppend(ab, "  ", GUTTER_WIDTH); break;
+                }
+                cols -= GUTTER_WIDTH;
+            }
             int len = E.row[fileRow].rsize - E.colOff;
             if(len < 0) len = 0;
-            if(len > E.screenCols) len = E.screenCols;
+            if(len > cols) len = cols;
+
+            // render columns of the selection on this row, drawn in inverse video
+            int selStart = 0, selEnd = 0, inverse = 0;
+            if(haveSel && fileRow >= y0 && fileRow <= y1) {
+                selStart = fileRow == y0 ? editorRowCxToRx(&E.row[fileRow], x0) - E.colOff : 0;
+                selEnd = fileRow == y1 ? editorRowCxToRx(&E.row[fileRow], x1) - E.colOff : len;
+            }
+
+            // misspelled words are underlined, spans are in render columns
+            struct spellRow *checked = spellActive() ? spellFind(fileRow) : NULL;
+            int numSpell = checked ? checked->numSpans : 0;
+            int k = 0, underline = 0;
 
             // attempt to highlight numbers by coloring each digit char red
             char *c  = &E.row[fileRow].render[E.colOff];
             unsigned char *hl = &E.row[fileRow].hl[E.colOff];
             int current_color = -1; // default text color
             int j;
-            for (j = 0; j < len; j++) {
-                // check if current character is a control character
-                if(iscntrl(c[j])) {
-                    char sym = (c[j] <= 26) ? '@' + c[j] : '?';
-                    abAppend(ab, "\x1b[7m", 4);
-                    abAppend(ab, &sym, 1);
-                    abAppend(ab, "\x1b[m", 2);
-                    if(current_color != -1) {
-                        char buf[16];
-                        int cLen = snprintf(buf, sizeof(buf), "\x1b[%dm", current_color);
-                        abAppend(ab, buf, cLen);
+            if(E.row[fileRow].plain) {
+                // nothing to escape, append whole runs of one color and selection state
+                j = 0;
+                while(j < len) {
+                    int selected = j >= selStart && j < selEnd;
+                    int stop = selected ? selEnd : (j < selStart ? selStart : len);
+                    while(k < numSpell && checked->spans[k].start + checked->spans[k].len - E.colOff <= j) k++;
+                    int under = k < numSpell && checked->spans[k].start - E.colOff <= j;
+                    if(k < numSpell) {
+                        int edge = checked->spans[k].start - E.colOff + (under ? checked->spans[k].len : 0);
+                        if(edge < stop) stop = edge;
                     }
-                } else if (hl[j] == HL_NORMAL) {
-                    if (current_color != -1) {
-                        abAppend(ab, "\x1b[39m", 5); // default text color
-                        current_color = -1;
+                    if(stop > len) stop = len;
+                    int end = hlRunEnd(hl, j, stop);
+                    if(selected != inverse) {
+                        abAppend(ab, selected ? "\x1b[7m" : "\x1b[27m", selected ? 4 : 5);
+                        inverse = selected;
                     }
-                    abAppend(ab, &c[j], 1);
-                } else {
-                    int color = editorSyntaxToColor(hl[j]);
-                    if (color != current_color) {
-                        current_color = color;
+                    if(under != underline) {
+                        abAppend(ab, under ? "\x1b[4m" : "\x1b[24m", under ? 4 : 5);
+                        underline = under;
+                    }
+                    int color = hl[j] == HL_NORMAL ? -1 : editorSyntaxToColor(hl[j]);
+                    if(color != current_color) {
                         char buf[16];
-                        int cLen = snprintf(buf, sizeof(buf), "\x1b[%dm", color);
+                        int cLen = color == -1 ? snprintf(buf, sizeof(buf), "\x1b[39m")
+                            : snprintf(buf, sizeof(buf), "\x1b[%dm", color);
                         abAppend(ab, buf, cLen);
+                        current_color = color;
+                    }
+                    abAppend(ab, &c[j], end - j);
+                    j = end;
+                }
+            } else {
+                for (j = 0; j < len; j++) {
+                    int selected = j >= selStart && j < selEnd;
+                    if(selected != inverse) {
+                        abAppend(ab, selected ? "\x1b[7m" : "\x1b[27m", selected ? 4 : 5);
+                        inverse = selected;
+                    }
+                    while(k < numSpell && checked->spans[k].start + checked->spans[k].len - E.colOff <= j) k++;
+                    int under = k < numSpell && checked->spans[k].start - E.colOff <= j;
+                    if(under != underline) {
+                        abAppend(ab, under ? "\x1b[4m" : "\x1b[24m", under ? 4 : 5);
+                        underline = under;
+                    }
+                    // check if current character is a control character
+                    if(iscntrl(c[j])) {
+                        char sym = (c[j] <= 26) ? '@' + c[j] : '?';
+                        abAppend(ab, "\x1b[7m", 4);
+                        abAppend(ab, &sym, 1);
+                        abAppend(ab, "\x1b[m", 3);
+                        inverse = 0;
+                        underline = 0;
+                        if(current_color != -1) {
+                            char buf[16];
+                            int cLen = snprintf(buf, sizeof(buf), "\x1b[%dm", current_color);
+                            abAppend(ab, buf, cLen);
+                        }
+                    } else if (hl[j] == HL_NORMAL) {
+                        if (current_color != -1) {
+                            abAppend(ab, "\x1b[39m", 5); // default text color
+                            current_color = -1;
+                        }
+                        abAppend(ab, &c[j], 1);
+                    } else {
+                        int color = editorSyntaxToColor(hl[j]);
+                        if (color != current_color) {
+                            current_color = color;
+                            char buf[16];
+                            int cLen = snprintf(buf, sizeof(buf), "\x1b[%dm", color);
+                            abAppend(ab, buf, cLen);
+                        }
+                        abAppend(ab, &c[j], 1);
                     }
-                    abAppend(ab, &c[j], 1);
                 }
             }
+            if(inverse) abAppend(ab, "\x1b[27m", 5);
+            if(underline) abAppend(ab, "\x1b[24m", 5);
             abAppend(ab, "\x1b[39m", 5);
         }
 
         abAppend(ab, "\x1b[K", 3);
+        if(ruler) {
+            char cell[48];
+            abAppend(ab, cell, rulerCell(cell, sizeof(cell), y));
+        }
         // make room for status bar
         abAppend(ab, "\r\n", 2);
     }
@@ -930,13 +5924,17 @@ void editorDrawRows(struct abuf *ab) {
 
 void editorDrawStatusBar(struct abuf *ab) {
     abAppend(ab, "\x1b[7m", 4);
-    char status[80], rstatus[80];
-    int len = snprintf(status, sizeof(status), "%.20s - %d lines %s",
-    E.filename ? E.filename : "[No Name]", E.numRows,
+    char status[120], rstatus[80], search[64], stats[64];
+    statsStatus(stats, sizeof(stats));
+    int len = snprintf(status, sizeof(status), "%.20s - %d lines, %s %s",
+    E.filename ? E.filename : "[No Name]", E.numRows, stats,
     E.dirty ? "(modified)" : "");
-    int rLen = snprintf(rstatus, sizeof(rstatus), "%s | %d/%d",
+    searchStatus(search, sizeof(search));
+    int rLen = snprintf(rstatus, sizeof(rstatus), "%s%s%s | %d/%d",
+    search, search[0] ? " | " : "",
     E.syntax ? E.syntax->filetype : "no ft",
     E.cy + 1, E.numRows);
+    if(rLen >= (int)sizeof(rstatus)) rLen = sizeof(rstatus) - 1;
     if(len > E.screenCols) len = E.screenCols;
     abAppend(ab, status, len);
     while (len < E.screenCols) {
@@ -961,9 +5959,12 @@ void editorDrawMessageBar(struct abuf *ab) {
 }
 
 void editorRefreshScreen() {
+    perfBegin(PERF_DRAW);
     editorScroll();
 
-    struct abuf ab = ABUF_INIT;
+    // the frame buffer is kept between frames so drawing doesn't allocate
+    static struct abuf ab = ABUF_INIT;
+    ab.len = 0;
 
     // clear screen using VT100 escape sequences
     abAppend(&ab, "\x1b[?25l", 6);
@@ -974,13 +5975,15 @@ void editorRefreshScreen() {
     editorDrawMessageBar(&ab);
 
     char buf[32];
-    snprintf(buf, sizeof(buf), "\x1b[%d;%dH", (E.cy - E.rowOff) + 1, (E.rx - E.colOff) + 1);
+    snprintf(buf, sizeof(buf), "\x1b[%d;%dH", (E.cy - E.rowOff) + 1, (E.rx - E.colOff) + gutterWidth() + 1);
     abAppend(&ab, buf, strlen(buf));
 
     abAppend(&ab, "\x1b[?25h", 6);
+    if(latencyProbe()) abAppend(&ab, "\x1b[c", 3);
 
     write(STDOUT_FILENO, ab.b, ab.len);
-    abFree(&ab);
+    perfEnd();
+    watchdogFrameDone();
 }
 
 void editorSetStatusMessage(const char *fmt, ...) {
@@ -999,18 +6002,30 @@ void editorSetStatusMessage(const char *fmt, ...) {
 /*** input ***/
 
 // display a prompt in the status bar & let the user input a line of text after the prompt
-char *editorPrompt(char *prompt, void (*callback)(char *, int)) {
+char *editorPrompt(char *prompt, int (*callback)(char *, int)) {
     size_t bufSize = 128;
     char *buf = malloc(bufSize); // store user input
 
     size_t bufLen = 0;
     buf[0] = '\0';
 
+    int busy = 0; // callback has work left
+    jobHold(1);
     // repeatedly set the status message, refresh the screen and wait for a keypress to handle
     while (1) {
         editorSetStatusMessage(prompt, buf);
         editorRefreshScreen();
 
+        // let the callback work in slices until a key arrives, redrawing now and then
+        uint64_t lastFrame = monotonicNs();
+        while (busy && !editorKeyPending()) {
+            busy = callback(buf, IDLE_KEY);
+            if (!busy || monotonicNs() - lastFrame > 50000000) {
+                editorRefreshScreen();
+                lastFrame = monotonicNs();
+            }
+        }
+
         int c = editorReadKey();
         if (c == DEL_KEY || c == CTRL_KEY('h') || c == BACKSPACE) {
             if (bufLen != 0) buf[--bufLen] = '\0';
@@ -1018,11 +6033,13 @@ char *editorPrompt(char *prompt, void (*callback)(char *, int)) {
             editorSetStatusMessage("");
             if (callback) callback(buf, c);
             free(buf);
+            jobHold(0);
             return NULL;
         } else if (c == '\r') {
             if (bufLen != 0) {
                 editorSetStatusMessage("");
                 if (callback) callback(buf, c);
+                jobHold(0);
                 return buf;
             }
         } else if (!iscntrl(c) && c < 128) {
@@ -1034,7 +6051,7 @@ char *editorPrompt(char *prompt, void (*callback)(char *, int)) {
             buf[bufLen] = '\0';
         }
 
-        if(callback) callback(buf, c);
+        if(callback) busy = callback(buf, c);
     }
 }
 
@@ -1083,11 +6100,108 @@ void editorMoveCursor(int key) {
     }
 }
 
+int editorIsWordToken(struct erowToken *t) {
+    return t->kind == TOK_IDENT || t->kind == TOK_KEYWORD ||
+        t->kind == TOK_TYPE || t->kind == TOK_NUMBER;
+}
+
+// move to the start of the next or previous word using the row's tokens
+void editorMoveWord(int key) {
+    if(E.cy >= E.numRows) {
+        if(key == CTRL_ARROW_LEFT) editorMoveCursor(ARROW_LEFT);
+        return;
+    }
+
+    erow *row = &E.row[E.cy];
+    struct erowToken *tokens = editorRowTokens(row);
+    int rx = editorRowCxToRx(row, E.cx);
+    int j;
+    if(key == CTRL_ARROW_RIGHT) {
+        for(j = 0; j < row->numTokens; j++) {
+            if(editorIsWordToken(&tokens[j]) && tokens[j].start > rx) {
+                E.cx = editorRowRxToCx(row, tokens[j].start);
+                return;
+            }
+        }
+        // no more words, stop at the end of the line before moving on
+        if(E.cx < row->size) {
+            E.cx = row->size;
+        } else if(E.cy + 1 < E.numRows) {
+            E.cy++;
+            E.cx = 0;
+        }
+    } else {
+        for(j = row->numTokens - 1; j >= 0; j--) {
+            if(editorIsWordToken(&tokens[j]) && tokens[j].start < rx) {
+                E.cx = editorRowRxToCx(row, tokens[j].start);
+                return;
+            }
+        }
+        if(E.cx > 0) {
+            E.cx = 0;
+        } else if(E.cy > 0) {
+            E.cy--;
+            E.cx = E.row[E.cy].size;
+        }
+    }
+}
+
+// jump to the bracket matching the one under or just before the cursor
+void editorMatchBracket() {
+    if(E.cy >= E.numRows) return;
+
+    erow *row = &E.row[E.cy];
+    struct erowToken *tokens = editorRowTokens(row);
+    int rx = editorRowCxToRx(row, E.cx);
+    int j, at = -1;
+    for(j = 0; j < row->numTokens; j++) {
+        if(tokens[j].kind != TOK_BRACKET) continue;
+        if(tokens[j].start == rx) {
+            at = j;
+            break;
+        }
+        if(tokens[j].start == rx - 1) at = j;
+    }
+    if(at == -1) return;
+
+    const char *pairs = "()[]{}";
+    char bracket = row->render[tokens[at].start];
+    int k = strchr(pairs, bracket) - pairs;
+    char other = pairs[k ^ 1];
+    int dir = (k & 1) ? -1 : 1; // closing brackets search backwards
+    int depth = 0;
+
+    // walk the bracket tokens of the following (or preceding) rows
+    int y = E.cy;
+    j = at;
+    while(1) {
+        for(; j >= 0 && j < row->numTokens; j += dir) {
+            if(tokens[j].kind != TOK_BRACKET) continue;
+            char b = row->render[tokens[j].start];
+            if(b == bracket) {
+                depth++;
+            } else if(b == other && --depth == 0) {
+                E.cy = y;
+                E.cx = editorRowRxToCx(row, tokens[j].start);
+                return;
+            }
+        }
+        y += dir;
+        if(y < 0 || y >= E.numRows) break;
+        row = &E.row[y];
+        tokens = editorRowTokens(row);
+        j = dir > 0 ? 0 : row->numTokens - 1;
+    }
+    editorSetStatusMessage("No matching bracket");
+}
+
 // wait for keypress and handle it
 void editorProcessKeypress() {
     static int quitTimes = CACTUS_QUIT_TIMES;
 
     int c = editorReadKey();
+    int lastYank = K.yank;
+    K.yank = -1;
 
     switch(c) {
         // ignore enter key
@@ -1096,13 +6210,15 @@ void editorProcessKeypress() {
             break;
 
         case CTRL_KEY('q'):
-            if (E.dirty && quitTimes > 0) {
+            if ((J.showing ? J.other.dirty : E.dirty) && quitTimes > 0) {
                 editorSetStatusMessage("WARNING!!! File has unsaved changes. Press Ctrl-Q %d more times to quit.", quitTimes);
                 quitTimes--;
                 return;
             }
+            sessionSave();
             write(STDOUT_FILENO, "\x1b[2J", 4);
             write(STDOUT_FILENO, "\x1b[H", 3);
+            latencyDrain();
             exit(0);
             break;
 
@@ -1155,9 +6271,59 @@ void editorProcessKeypress() {
             editorMoveCursor(c);
             break;
 
-        // do nothing with the ctrl-l and escape keys
-        case CTRL_KEY('l'):
+        case CTRL_ARROW_LEFT:
+        case CTRL_ARROW_RIGHT:
+            editorMoveWord(c);
+            break;
+
+        case CTRL_KEY('b'):
+            editorMatchBracket();
+            break;
+
+        // ctrl-space
+        case 0:
+            E.markSet = 1;
+            E.markX = E.cx;
+            E.markY = E.cy;
+            editorSetStatusMessage("Mark set");
+            break;
+
+        case CTRL_KEY('c'):
+        case CTRL_KEY('x'):
+            editorCopy(c == CTRL_KEY('x'));
+            break;
+
+        case CTRL_KEY('v'):
+            editorPaste();
+            break;
+
+        case CTRL_KEY('y'):
+            editorPastePrevious(lastYank);
+            break;
+
+        case CTRL_KEY('r'):
+            editorReindent();
+            break;
+
+        case CTRL_KEY('k'):
+            jobRun();
+            break;
+
+        case CTRL_KEY('o'):
+            jobToggleOutput();
+            break;
+
+        case CTRL_KEY('n'):
+        case CTRL_KEY('p'):
+            jobJump(c == CTRL_KEY('n') ? 1 : -1);
+            break;
+
+        // escape drops the selection, do nothing with ctrl-l
         case '\x1b':
+            E.markSet = 0;
+            break;
+
+        case CTRL_KEY('l'):
             break;
 
         default:
@@ -1168,6 +6334,724 @@ void editorProcessKeypress() {
     quitTimes = CACTUS_QUIT_TIMES;
 }
 
+/*** bench ***/
+
+// cactus --bench [file] drives the editing paths headlessly on a file (a generated
+// one if none is given) and reports time and allocator calls per operation.
+// steady state operations have an allocation budget and the run fails if one is exceeded
+
+#define BENCH_ROWS 100000
+#define BENCH_NO_BUDGET -1
+
+uint64_t benchStartNs;
+unsigned long benchStartAllocs;
+
+void benchStart() {
+    benchStartAllocs = allocCalls;
+    benchStartNs = monotonicNs();
+}
+
+void benchStop(const char *name, long ops, double budget) {
+    uint64_t ns = monotonicNs() - benchStartNs;
+    double allocs = (double)(allocCalls - benchStartAllocs) / ops;
+    int over = budget != BENCH_NO_BUDGET && allocs > budget;
+    if(over) B.failed = 1;
+
+    char limit[32] = "-";
+    if(budget != BENCH_NO_BUDGET) snprintf(limit, sizeof(limit), "%.2f", budget);
+    dprintf(B.out, "%-10s %10ld %12.1f %12.3f %8s  %s\n", name, ops, (double)ns / ops,
+        allocs, limit, over ? "OVER BUDGET" : "ok");
+}
+
+// write a C-ish file with comments, strings, tabs and numbers to benchmark on
+void benchGenerate(char *path, size_t size) {
+    const char *dir = getenv("TMPDIR");
+    snprintf(path, size, "%s/cactus-bench-XXXXXX.c", dir ? dir : "/tmp");
+    int fd = mkstemps(path, 2);
+    if(fd == -1) die("mkstemps");
+    FILE *fp = fdopen(fd, "w");
+    for(int i = 0; i < BENCH_ROWS; i++) {
+        switch(i % 8) {
+            case 0: fprintf(fp, "/* block %d\n", i); break;
+            case 1: fprintf(fp, " * still a comment */\n"); break;
+            case 2: fprintf(fp, "int func%d(char *s, double d) {\n", i); break;
+            case 3: fprintf(fp, "\tif(s[%d] == '\\t') return %d.5; // tab\n", i % 64, i); break;
+            case 4: fprintf(fp, "\tprintf(\"row %%d of \\\"%d\\\"\\n\", %d);\n", i, i); break;
+            case 5: fprintf(fp, "\tfor(unsigned long j = 0; j < %d; j++) total += j * 0x%x;\n", i, i); break;
+            case 6: fprintf(fp, "\treturn d;\n"); break;
+            case 7: fprintf(fp, "}\n"); break;
+        }
+    }
+    fclose(fp);
+}
+
+int benchRun(char *filename) {
+    char generated[1024] = "";
+    if(filename == NULL) {
+        benchGenerate(generated, sizeof(generated));
+        filename = generated;
+    }
+
+    // frames go to /dev/null, results to the real stdout
+    B.out = dup(STDOUT_FILENO);
+    int null = open("/dev/null", O_WRONLY);
+    if(B.out == -1 || null == -1 || dup2(null, STDOUT_FILENO) == -1) die("bench: /dev/null");
+    close(null);
+
+    dprintf(B.out, "%-10s %10s %12s %12s %8s\n", "workload", "ops", "ns/op", "allocs/op", "budget");
+
+    benchStart();
+    editorOpen(filename);
+    benchStop("load", E.numRows ? E.numRows : 1, BENCH_NO_BUDGET);
+    if(generated[0]) unlink(generated);
+    if(E.numRows == 0) {
+        dprintf(B.out, "bench: %s is empty\n", filename);
+        return 1;
+    }
+
+    benchStart();
+    editorSelectSyntaxHighlight();
+    benchStop("highlight", E.numRows, 0);
+
+    // scroll through the file a screen at a time, drawing every frame
+    int frames = 2000, i;
+    // rebuild the render text of every row, which should run at memory speed
+    benchStart();
+    for(i = 0; i < E.numRows; i++) editorRenderRow(&E.row[i]);
+    benchStop("rerender", E.numRows, 0);
+
+    for(i = 0; i < 10; i++) editorRefreshScreen();
+    benchStart();
+    for(i = 0; i < frames; i++) {
+        E.cy = (long)i * E.screenRows % E.numRows;
+        editorRefreshScreen();
+    }
+    benchStop("render", frames, 0);
+
+    static const int moves[] = { ARROW_DOWN, ARROW_RIGHT, ARROW_RIGHT, ARROW_UP, ARROW_LEFT, ARROW_DOWN };
+    int numMoves = 100000;
+    E.cy = E.numRows / 2;
+    E.cx = 0;
+    benchStart();
+    for(i = 0; i < numMoves; i++) editorMoveCursor(moves[i % 6]);
+    benchStop("cursor", numMoves, 0);
+
+    // type into a row and delete it again, once to warm up the row's buffers
+    int chars = 1000;
+    for(int round = 0; round < 2; round++) {
+        E.cy = E.numRows / 2;
+        E.cx = E.row[E.cy].size;
+        if(round) benchStart();
+        for(i = 0; i < chars; i++) editorInsertChar('a' + i % 26);
+        for(i = 0; i < chars; i++) editorDelChar();
+        if(round) benchStop("typing", chars * 2, 0);
+    }
+
+    // incremental search: type the query, then step through matches
+    // in all of the text, then only in code (which needs the highlight classes)
+    const char *query = "return";
+    char buf[16];
+    int steps = 200;
+    for(int round = 0; round < 4; round++) {
+        S.scope = round < 2 ? SEARCH_ALL : SEARCH_CODE;
+        E.cy = E.cx = 0;
+        if(round & 1) benchStart();
+        for(i = 0; query[i]; i++) {
+            memcpy(buf, query, i + 1);
+            buf[i + 1] = '\0';
+            // run the slices the prompt would run between keys to completion
+            if(editorFindCallback(buf, query[i])) while(editorFindCallback(buf, IDLE_KEY));
+        }
+        for(i = 0; i < steps; i++) editorFindCallback(buf, ARROW_DOWN);
+        editorFindCallback(buf, '\r');
+        if(round & 1) benchStop(S.scope == SEARCH_ALL ? "search" : "scoped", i + (int)strlen(query), 0);
+    }
+    S.scope = SEARCH_ALL;
+
+    // re-indent the whole file, once to fix it up and then on text that's already right
+    E.markSet = 0;
+    editorReindent();
+    benchStart();
+    editorReindent();
+    benchStop("reindent", E.numRows, 0);
+
+    // copy the whole file and paste it at the end, copying must not touch the text
+    int lines = E.numRows;
+    benchStart();
+    editorKillCopy(0, 0, E.row[lines - 1].size, lines - 1);
+    benchStop("copy", lines, 0.01);
+    E.cy = lines - 1;
+    E.cx = E.row[E.cy].size;
+    benchStart();
+    editorPaste();
+    benchStop("paste", lines, BENCH_NO_BUDGET);
+
+    return B.failed;
+}
+
+// cactus --stress runs inputs that have hit slow paths before, each in a child
+// process with a wall clock limit (alarm) and an address space limit (RLIMIT_AS).
+// the limits are about twice what each case measured, so a regression trips them long
+// before a blow-up does. bytesPerRow bounds the peak resident size over the row count
+
+struct stressCase {
+    const char *name;
+    void (*generate)(FILE *fp);
+    void (*run)();
+    int seconds;
+    int megabytes;
+    int bytesPerRow; // 0 for no bound
+};
+
+// one 50 MB line
+void stressLongLineGenerate(FILE *fp) {
+    for(int i = 0; i < 50 * 1024 * 1024 / 16; i++) fputs("int a = b(c); \t", fp);
+    fputc('\n', fp);
+}
+
+void stressLongLineRun() {
+    E.cy = 0;
+    editorMoveCursor(END_KEY);
+    editorRefreshScreen();
+    // every edit highlights the whole row again, so only a few
+    E.cx = E.row[0].size / 2;
+    for(int i = 0; i < 4; i++) {
+        editorInsertChar('x');
+        editorRefreshScreen();
+    }
+    for(int i = 0; i < 4; i++) {
+        editorDelChar();
+        editorRefreshScreen();
+    }
+    E.cx = 0;
+    if(editorFindCallback("zzz", 'z')) while(editorFindCallback("zzz", IDLE_KEY));
+    editorFindCallback("zzz", '\r');
+}
+
+// a million rows of code, then a comment opened and closed at the top
+void stressCommentGenerate(FILE *fp) {
+    for(int i = 0; i < 1000000; i++) fprintf(fp, "\tint v%d = \"s\" + %d; // c\n", i, i);
+}
+
+void stressCommentRun() {
+    for(int round = 0; round < 3; round++) {
+        E.cy = E.cx = 0;
+        editorInsertChar('/');
+        editorInsertChar('*');
+        editorRefreshScreen();
+        E.cy = E.numRows - 1;
+        editorRefreshScreen();
+        E.cy = 0;
+        E.cx = 2;
+        editorDelChar();
+        editorDelChar();
+        editorRefreshScreen();
+    }
+}
+
+// a 400 KB line of tabs, walked across a character at a time
+void stressTabsGenerate(FILE *fp) {
+    for(int i = 0; i < 200000; i++) fputs("\tx", fp);
+    fputc('\n', fp);
+}
+
+void stressTabsRun() {
+    E.cy = E.cx = 0;
+    for(int i = 0; i < 100000; i++) {
+        editorMoveCursor(ARROW_RIGHT);
+        editorRefreshScreen();
+    }
+    for(int i = 0; i < 100000; i++) {
+        editorMoveCursor(ARROW_LEFT);
+        editorRefreshScreen();
+    }
+}
+
+// five million empty rows
+void stressEmptyGenerate(FILE *fp) {
+    for(int i = 0; i < 5000000; i++) fputc('\n', fp);
+}
+
+void stressEmptyRun() {
+    for(int i = 0; i < 1000; i++) {
+        E.cy = (long)i * 4999 % E.numRows;
+        editorRefreshScreen();
+    }
+    E.cy = E.numRows / 2;
+    E.cx = 0;
+    for(int i = 0; i < 100; i++) editorInsertNewLine();
+    editorRefreshScreen();
+}
+
+// two million rows with enter pressed at the top of them, which moves every row after it
+void stressEnterGenerate(FILE *fp) {
+    for(int i = 0; i < 2000000; i++) fprintf(fp, "line %d of the file\n", i);
+}
+
+void stressEnterRun() {
+    E.cy = E.cx = 0;
+    editorRefreshScreen();
+    for(int i = 0; i < 200; i++) {
+        editorInsertNewLine();
+        editorRefreshScreen();
+    }
+}
+
+// copy 200,000 rows and paste them into the middle ten times
+void stressPasteGenerate(FILE *fp) {
+    for(int i = 0; i < 200000; i++) fprintf(fp, "row %d { \"%d\" }\n", i, i);
+}
+
+void stressPasteRun() {
+    int lines = E.numRows;
+    editorKillCopy(0, 0, E.row[lines - 1].size, lines - 1);
+    for(int i = 0; i < 10; i++) {
+        E.cy = E.numRows / 2;
+        E.cx = 3;
+        editorPaste();
+        editorRefreshScreen();
+    }
+}
+
+// 20 MB of random bytes, mostly control and non-ascii
+void stressBinaryGenerate(FILE *fp) {
+    uint32_t x = 2463534242u;
+    for(int i = 0; i < 20 * 1024 * 1024; i++) {
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        fputc(x & 0xff, fp);
+    }
+}
+
+void stressBinaryRun() {
+    for(int i = 0; i < 1000; i++) {
+        E.cy = (long)i * 997 % E.numRows;
+        editorRefreshScreen();
+    }
+    E.cy = E.cx = 0;
+    if(editorFindCallback("\x01\x02\x03", 3)) while(editorFindCallback("\x01\x02\x03", IDLE_KEY));
+    editorFindCallback("\x01\x02\x03", '\r');
+}
+
+struct stressCase stressCases[] = {
+    { "long line", stressLongLineGenerate, stressLongLineRun, 34, 1250, 0 },
+    { "comment", stressCommentGenerate, stressCommentRun, 4, 850, 0 },
+    { "tabs", stressTabsGenerate, stressTabsRun, 2, 20, 0 },
+    { "empty rows", stressEmptyGenerate, stressEmptyRun, 14, 2850, 360 },
+    { "enter at top", stressEnterGenerate, stressEnterRun, 22, 1500, 0 },
+    { "paste", stressPasteGenerate, stressPasteRun, 7, 2200, 0 },
+    { "binary", stressBinaryGenerate, stressBinaryRun, 5, 320, 0 },
+};
+
+int stressRun() {
+    dprintf(STDOUT_FILENO, "%-12s %10s %10s %10s %10s\n", "case", "ms", "limit", "peak MB", "limit");
+    int failed = 0;
+    for(size_t c = 0; c < sizeof(stressCases) / sizeof(stressCases[0]); c++) {
+        struct stressCase *sc = &stressCases[c];
+        char path[1024];
+        const char *dir = getenv("TMPDIR");
+        snprintf(path, sizeof(path), "%s/cactus-stress-XXXXXX", dir ? dir : "/tmp");
+        int fd = mkstemp(path);
+        if(fd == -1) die("mkstemp");
+        FILE *fp = fdopen(fd, "w");
+        sc->generate(fp);
+        fclose(fp);
+
+        uint64_t start = monotonicNs();
+        pid_t pid = fork();
+        if(pid == -1) die("fork");
+        if(pid == 0) {
+            struct rlimit lim = { (rlim_t)sc->megabytes << 20, (rlim_t)sc->megabytes << 20 };
+            setrlimit(RLIMIT_AS, &lim);
+            alarm(sc->seconds);
+            int null = open("/dev/null", O_WRONLY);
+            if(null == -1 || dup2(null, STDOUT_FILENO) == -1) _exit(2);
+            editorOpen(path);
+            sc->run();
+            if(sc->bytesPerRow) {
+                struct rusage self;
+                getrusage(RUSAGE_SELF, &self);
+                if(self.ru_maxrss * 1024 / (E.numRows ? E.numRows : 1) > sc->bytesPerRow) _exit(3);
+            }
+            _exit(0);
+        }
+        int status;
+        struct rusage ru;
+        while(wait4(pid, &status, 0, &ru) == -1 && errno == EINTR);
+        uint64_t ms = (monotonicNs() - start) / 1000000;
+        unlink(path);
+
+        const char *verdict = "ok";
+        if(WIFSIGNALED(status) && WTERMSIG(status) == SIGALRM) verdict = "OVER TIME";
+        else if(WIFEXITED(status) && WEXITSTATUS(status) == 3) verdict = "OVER BYTES PER ROW";
+        else if(!WIFEXITED(status) || WEXITSTATUS(status) != 0) verdict = "FAILED (out of memory?)";
+        if(strcmp(verdict, "ok")) failed = 1;
+        dprintf(STDOUT_FILENO, "%-12s %10llu %10d %10ld %10d  %s\n", sc->name, (unsigned long long)ms,
+            sc->seconds * 1000, ru.ru_maxrss / 1024, sc->megabytes, verdict);
+    }
+    return failed;
+}
+
+// cactus --selfcheck[=seed] applies random edits through the row operations to a small
+// C file and a plain copy of its text. after every edit each incremental or cached
+// structure is compared with the same thing worked out from scratch: the text, render,
+// rx marks, counts, brace depths, highlighting (against a full pass) and search counts
+
+#define SELFCHECK_STEPS 3000
+
+struct selfcheckState {
+    uint64_t seed, rng;
+    int step;
+    char *text; // what the buffer should hold, every row ends in '\n'
+    int len, cap;
+    char *buf; // scratch for from-scratch results
+    int bufCap;
+};
+
+struct selfcheckState SC;
+
+uint32_t selfcheckRandom(uint32_t n) {
+    SC.rng ^= SC.rng << 13;
+    SC.rng ^= SC.rng >> 7;
+    SC.rng ^= SC.rng << 17;
+    return n ? (uint32_t)(SC.rng >> 32) % n : 0;
+}
+
+// fragments that open and close comments, strings, braces, #if 0 blocks and user types
+const char *selfcheckFragments[] = {
+    "int ", "x", "foo", " ", "\t", "{", "}", "/*", "*/", "//", "\"", "'", "\\", "#if 0", "#endif",
+    "typedef int T;", "T", "struct S", "#define M 1", "M", "0x1f", "return", "\xc3\xa9", "\x01", "=="
+};
+
+int selfcheckString(char *s, int size) {
+    int n = 0, parts = selfcheckRandom(6);
+    int numFragments = sizeof(selfcheckFragments) / sizeof(selfcheckFragments[0]);
+    for(int i = 0; i < parts; i++) {
+        const char *f = selfcheckFragments[selfcheckRandom(numFragments)];
+        int len = strlen(f);
+        if(n + len >= size) break;
+        memcpy(s + n, f, len);
+        n += len;
+    }
+    s[n] = '\0';
+    return n;
+}
+
+void selfcheckFail(const char *fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    fprintf(stderr, "selfcheck: seed %llu step %d: ", (unsigned long long)SC.seed, SC.step);
+    vfprintf(stderr, fmt, ap);
+    fprintf(stderr, "\n");
+    va_end(ap);
+    exit(1);
+}
+
+// offset of (x, y) in the plain copy
+int selfcheckOffset(int x, int y) {
+    int off = 0;
+    while(y-- > 0) off = (char *)memchr(SC.text + off, '\n', SC.len - off) - SC.text + 1;
+    return off + x;
+}
+
+void selfcheckInsert(int off, const char *s, int len) {
+    SC.text = editorReserve(SC.text, &SC.cap, SC.len + len);
+    memmove(SC.text + off + len, SC.text + off, SC.len - off);
+    memcpy(SC.text + off, s, len);
+    SC.len += len;
+}
+
+void selfcheckDelete(int from, int to) {
+    memmove(SC.text + from, SC.text + to, SC.len - to);
+    SC.len -= to - from;
+}
+
+// a random position, y < E.numRows
+void selfcheckPosition(int *x, int *y) {
+    *y = selfcheckRandom(E.numRows);
+    *x = selfcheckRandom(E.row[*y].size + 1);
+}
+
+void selfcheckEdit() {
+    char s[128];
+    int x, y, x1, y1, len, c;
+    if(E.numRows == 0) {
+        editorInsertRow(0, "", 0);
+        selfcheckInsert(0, "\n", 1);
+        return;
+    }
+    selfcheckPosition(&x, &y);
+    switch(selfcheckRandom(7)) {
+        case 0:
+            c = "aT{}/*\"\t #\\\xc3"[selfcheckRandom(13)];
+            editorRowInsertChar(&E.row[y], x, c);
+            s[0] = c;
+            selfcheckInsert(selfcheckOffset(x, y), s, 1);
+            break;
+        case 1:
+            if(x == E.row[y].size) break;
+            editorRowDelChar(&E.row[y], x);
+            selfcheckDelete(selfcheckOffset(x, y), selfcheckOffset(x, y) + 1);
+            break;
+        case 2:
+            y = selfcheckRandom(E.numRows + 1);
+            len = selfcheckString(s, sizeof(s) - 1);
+            editorInsertRow(y, s, len);
+            s[len] = '\n';
+            selfcheckInsert(selfcheckOffset(0, y), s, len + 1);
+            break;
+        case 3:
+            if(E.numRows < 40) break;
+            len = 1 + selfcheckRandom(3);
+            if(y + len > E.numRows) len = E.numRows - y;
+            editorDelRows(y, len);
+            selfcheckDelete(selfcheckOffset(0, y), selfcheckOffset(0, y + len));
+            break;
+        case 4:
+            len = selfcheckString(s, sizeof(s));
+            editorRowAppendString(&E.row[y], s, len);
+            selfcheckInsert(selfcheckOffset(E.row[y].size - len, y), s, len);
+            break;
+        case 5:
+        case 6:
+            // a range to delete, or to copy and paste somewhere else
+            selfcheckPosition(&x1, &y1);
+            if(y1 < y || (y1 == y && x1 < x)) {
+                int t = x; x = x1; x1 = t;
+                t = y; y = y1; y1 = t;
+            }
+            int from = selfcheckOffset(x, y), to = selfcheckOffset(x1, y1);
+            if(from == to) break;
+            if(y1 - y > 8) {
+                y1 = y + 8;
+                x1 = 0;
+                to = selfcheckOffset(x1, y1);
+            }
+            if(E.numRows > 40 && selfcheckRandom(2)) {
+                editorDelRange(x, y, x1, y1);
+                selfcheckDelete(from, to);
+            } else {
+                char *copy = malloc(to - from);
+                memcpy(copy, SC.text + from, to - from);
+                editorKillCopy(x, y, x1, y1);
+                selfcheckPosition(&E.cx, &E.cy);
+                int at = selfcheckOffset(E.cx, E.cy);
+                editorPaste();
+                selfcheckInsert(at, copy, to - from);
+                free(copy);
+            }
+            break;
+    }
+}
+
+void selfcheckText() {
+    int len;
+    char *text = editorRowsToString(&len);
+    if(len != SC.len || memcmp(text, SC.text, len))
+        selfcheckFail("text differs (%d bytes, expected %d)", len, SC.len);
+    free(text);
+}
+
+// render of every row, and rx conversions against a scan from the start of the row
+void selfcheckRender() {
+    for(int j = 0; j < E.numRows; j++) {
+        erow *row = &E.row[j];
+        int n = 0, plain = 1;
+        SC.buf = editorReserve(SC.buf, &SC.bufCap, row->size * CACTUS_TAB_STOP + 1);
+        for(int i = 0; i < row->size; i++) {
+            unsigned char c = row->chars[i];
+            if(c == '\t') {
+                do SC.buf[n++] = ' '; while(n % CACTUS_TAB_STOP);
+            } else {
+                SC.buf[n++] = c;
+                if(c < 32 || c >= 127) plain = 0;
+            }
+        }
+        if(n != row->rsize || memcmp(SC.buf, row->render, n) || row->render[n] != '\0')
+            selfcheckFail("render of row %d differs", j);
+        if(plain != row->plain) selfcheckFail("row %d plain is %d, expected %d", j, row->plain, plain);
+
+        int cx = selfcheckRandom(row->size + 1), rx = 0;
+        for(int i = 0; i < cx; i++) rx = row->chars[i] == '\t' ? (rx / CACTUS_TAB_STOP + 1) * CACTUS_TAB_STOP : rx + 1;
+        if(editorRowCxToRx(row, cx) != rx) selfcheckFail("row %d cx %d is rx %d, expected %d", j, cx, editorRowCxToRx(row, cx), rx);
+        if(editorRowRxToCx(row, rx) != cx && (cx == row->size || row->chars[cx] != '\t'))
+            selfcheckFail("row %d rx %d is cx %d, expected %d", j, rx, editorRowRxToCx(row, rx), cx);
+    }
+}
+
+// counts of the whole buffer and of a random range against a plain count of the copy
+void selfcheckStats() {
+    int rows = 0, rulerRows = 0;
+    for(int b = 0; b < ST.numBlocks; b++) rows += ST.block[b].rows;
+    for(int b = 0; b < RU.sums.numBlocks; b++) rulerRows += RU.sums.block[b].rows;
+    if(rows != E.numRows || rulerRows != E.numRows)
+        selfcheckFail("row sums have %d and %d rows, the buffer %d", rows, rulerRows, E.numRows);
+    if(E.numRows == 0) return;
+    int x0, y0, x1, y1;
+    selfcheckPosition(&x0, &y0);
+    selfcheckPosition(&x1, &y1);
+    if(y1 < y0 || (y1 == y0 && x1 < x0)) {
+        int t = x0; x0 = x1; x1 = t;
+        t = y0; y0 = y1; y1 = t;
+    }
+    struct textStats got = { 0, 0, 0 }, want;
+    for(int pass = 0; pass < 2; pass++) {
+        int from = pass ? selfcheckOffset(x0, y0) : 0, to = pass ? selfcheckOffset(x1, y1) : SC.len;
+        memset(&want, 0, sizeof(want));
+        for(int i = from; i < to; i++) {
+            unsigned char c = SC.text[i];
+            want.bytes++;
+            want.chars += (c & 0xc0) != 0x80;
+            want.words += !isspace(c) && (i == from || isspace((unsigned char)SC.text[i - 1]));
+        }
+        if(pass) statsRange(x0, y0, x1, y1, &got);
+        else statsRows(0, E.numRows, &got);
+        if(memcmp(&got, &want, sizeof(got)))
+            selfcheckFail("%s counts %lld/%lld/%lld, expected %lld/%lld/%lld", pass ? "range" : "buffer",
+                (long long)got.bytes, (long long)got.words, (long long)got.chars,
+                (long long)want.bytes, (long long)want.words, (long long)want.chars);
+    }
+}
+
+// highlighting as drawing would see it against a full pass over the file,
+// and brace depths against a running sum
+void selfcheckHighlight() {
+    int j, total = 0;
+    for(j = 0; j < E.numRows; j++) {
+        if(editorRowStale(&E.row[j])) editorUpdateSyntax(&E.row[j]);
+        total += E.row[j].rsize + 3 * sizeof(int);
+    }
+    SC.buf = editorReserve(SC.buf, &SC.bufCap, total);
+    char *p = SC.buf;
+    for(j = 0; j < E.numRows; j++) {
+        erow *row = &E.row[j];
+        int fields[3] = { row->hl_state, row->braceDelta, row->leadingClosers };
+        memcpy(p, fields, sizeof(fields));
+        if(row->rsize) memcpy(p + sizeof(fields), row->hl, row->rsize);
+        p += sizeof(fields) + row->rsize;
+        if(braceDepth(j) != (j ? braceDepth(j - 1) : 0) + row->braceDelta)
+            selfcheckFail("brace depth after row %d is off", j);
+    }
+
+    symbolBulkBegin();
+    for(j = 0; j < E.numRows; j++) editorHighlightRow(&E.row[j]);
+    symbolBulkEnd(1);
+    for(j = 0; j < E.numRows; j++) if(editorRowStale(&E.row[j])) editorUpdateSyntax(&E.row[j]);
+
+    p = SC.buf;
+    for(j = 0; j < E.numRows; j++) {
+        erow *row = &E.row[j];
+        int fields[3] = { row->hl_state, row->braceDelta, row->leadingClosers };
+        if(memcmp(p, fields, sizeof(fields))) selfcheckFail("lexer state or braces of row %d differ", j);
+        if(row->rsize && memcmp(p + sizeof(fields), row->hl, row->rsize))
+            selfcheckFail("highlighting of row %d differs from a full pass", j);
+        p += sizeof(fields) + row->rsize;
+    }
+}
+
+// edited and unclosed string rows the ruler has summed against a count of the rows
+void selfcheckRuler() {
+    int rows = selfcheckRandom(E.numRows + 1);
+    int64_t got[2] = { 0, 0 }, want[2] = { 0, 0 };
+    rowSumsRange(&RU.sums, 0, rows, got);
+    for(int j = 0; j < rows; j++) {
+        want[0] += E.row[j].edited;
+        want[1] += rulerUnclosed(E.row[j].hl_state);
+    }
+    if(got[0] != want[0] || got[1] != want[1])
+        selfcheckFail("ruler counts %lld/%lld over %d rows, expected %lld/%lld", (long long)got[0],
+            (long long)got[1], rows, (long long)want[0], (long long)want[1]);
+}
+
+// match count of an incremental search against strstr over fresh render text, with
+// more than a count block of rows added at the end while it runs. the arrows then have
+// to step through the matches one ordinal at a time
+void selfcheckSearch() {
+    if(E.numRows == 0) return;
+    int x, y;
+    selfcheckPosition(&x, &y);
+    erow *row = &E.row[y];
+    int len = 1 + selfcheckRandom(3);
+    int rx = editorRowCxToRx(row, x);
+    if(rx + len > row->rsize) return;
+    char query[8];
+    memcpy(query, &row->render[rx], len);
+    query[len] = '\0';
+    if(memchr(query, '\0', len)) return;
+
+    S.scope = SEARCH_ALL;
+    E.cx = E.cy = 0;
+    char buf[8];
+    for(int i = 0; i < len; i++) {
+        memcpy(buf, query, i + 1);
+        buf[i + 1] = '\0';
+        editorFindCallback(buf, query[i]);
+    }
+    int rows = E.numRows, added = SEARCH_BLOCK + selfcheckRandom(SEARCH_BLOCK);
+    char s[128];
+    for(int j = 0; j < added; j++) {
+        int n = selfcheckString(s, sizeof(s));
+        editorInsertRow(E.numRows, s, n);
+    }
+    while(editorFindCallback(buf, IDLE_KEY));
+
+    long want = 0;
+    for(int j = 0; j < E.numRows; j++) {
+        const char *r = E.row[j].render;
+        while((r = strstr(r, query)) != NULL) {
+            want++;
+            r += len;
+        }
+    }
+    long got = S.total, buckets = 0;
+    rulerFoldMatches();
+    for(int y = 0; y < E.screenRows; y++) buckets += RU.matches[y];
+    // with no match shown yet the first arrow goes to the first match
+    long ordinal = S.lastMatch == -1 ? 0 : searchOrdinal();
+    for(int step = 0; step < 40 && want > 0 && got == want; step++) {
+        int key = step < 20 ? ARROW_DOWN : ARROW_UP;
+        long expect = key == ARROW_DOWN ? ordinal % want + 1 : (ordinal + want - 2) % want + 1;
+        editorFindCallback(buf, key);
+        while(editorFindCallback(buf, IDLE_KEY));
+        ordinal = searchOrdinal();
+        if(ordinal != expect) selfcheckFail("arrow to match %ld of \"%s\" went to %ld", expect, query, ordinal);
+    }
+    editorFindCallback(buf, '\r');
+    editorDelRows(rows, added);
+    if(got != want) selfcheckFail("search for \"%s\" counted %ld, expected %ld", query, got, want);
+    if(buckets != want) selfcheckFail("ruler buckets have %ld matches of \"%s\", expected %ld", buckets, query, want);
+}
+
+int selfcheckRun(uint64_t seed) {
+    SC.seed = seed;
+    SC.rng = seed * 0x9e3779b97f4a7c15ULL + 1;
+    free(E.filename);
+    E.filename = strdup("selfcheck.c");
+    E.syntax = editorDetectSyntax();
+
+    char s[128];
+    for(int j = 0; j < 60; j++) {
+        int len = selfcheckString(s, sizeof(s) - 1);
+        editorInsertRow(j, s, len);
+        s[len] = '\n';
+        selfcheckInsert(SC.len, s, len + 1);
+    }
+    editorSelectSyntaxHighlight();
+
+    for(SC.step = 1; SC.step <= SELFCHECK_STEPS; SC.step++) {
+        selfcheckEdit();
+        selfcheckText();
+        selfcheckRender();
+        selfcheckStats();
+        selfcheckHighlight();
+        selfcheckRuler();
+        if(SC.step % 10 == 0) selfcheckSearch();
+    }
+    printf("selfcheck: seed %llu, %d edits ok\n", (unsigned long long)seed, SELFCHECK_STEPS);
+    return 0;
+}
+
 /*** init ***/
 
 // initialize all fields in the E struct
@@ -1179,25 +7063,82 @@ void initEditor() {
     E.colOff = 0;
     E.numRows = 0;
     E.row = NULL;
+    E.rowCap = 0;
     E.dirty = 0; // initialize dirty state
     E.filename = NULL;
     E.statusmsg[0] = '\0';
     E.statusmsg_time = 0;
     E.syntax = NULL; // no filetype so no syntax highlighting
+    E.hlCacheHash = 0;
+    E.diskSize = E.diskMtime = 0;
+
+    editorLoadSyntaxDB();
+    spellLoadDict();
 
-    if (getWindowSize(&E.screenRows, &E.screenCols) == -1) die("getWindowSize");
+    if (B.running) {
+        E.screenRows = 24;
+        E.screenCols = 80;
+    } else if (getWindowSize(&E.screenRows, &E.screenCols) == -1) die("getWindowSize");
     E.screenRows -= 2;
 }
 
 int main(int argc, char* argv[]) {
+    char *filename = NULL;
+    char **replace = NULL;
+    int regex = 0, restore = 0, stress = 0, selfcheck = 0;
+    uint64_t seed = 1;
+    for(int i = 1; i < argc; i++) {
+        if(!strcmp(argv[i], "--bench")) {
+            B.running = 1;
+        } else if(!strcmp(argv[i], "--stress")) {
+            B.running = 1;
+            stress = 1;
+        } else if(!strncmp(argv[i], "--selfcheck", 11)) {
+            B.running = 1;
+            selfcheck = 1;
+            if(argv[i][11] == '=') seed = strtoull(argv[i] + 12, NULL, 10);
+        } else if(!strcmp(argv[i], "--perf-counters")) {
+            perfInit();
+        } else if(!strncmp(argv[i], "--profile", 9)) {
+            profInit(argv[i][9] == '=' ? argv[i] + 10 : "cactus.folded");
+        } else if(!strncmp(argv[i], "--latency", 9)) {
+            latencyInit(argv[i][9] == '=' ? argv[i] + 10 : NULL);
+        } else if(!strncmp(argv[i], "--watchdog", 10)) {
+            watchdogInit(argv[i][10] == '=' ? atoi(argv[i] + 11) : 0);
+        } else if(!strcmp(argv[i], "--replace")) {
+            if(i + 3 >= argc) {
+                fprintf(stderr, "usage: cactus --replace PATTERN REPLACEMENT FILE [--regex]\n");
+                return 1;
+            }
+            replace = &argv[i + 1];
+            i += 3;
+        } else if(!strcmp(argv[i], "--regex")) {
+            regex = 1;
+        } else if(!strcmp(argv[i], "--restore")) {
+            restore = 1;
+        } else {
+            filename = argv[i];
+        }
+    }
+
+    if(replace) return streamReplace(replace[2], replace[0], replace[1], regex);
+
+    if(B.running) {
+        initEditor();
+        if(selfcheck) return selfcheckRun(seed);
+        return stress ? stressRun() : benchRun(filename);
+    }
+
     enableRawMode();
     initEditor();
-    if(argc >= 2) {
-        editorOpen(argv[1]);
-    }
 
     // set initial status message
     editorSetStatusMessage("HELP: Ctrl-S = save | Ctrl-Q = quit | Ctrl-F = find");
+    if(restore) {
+        if(!sessionRestore()) editorSetStatusMessage("No session to restore");
+    } else if(filename) {
+        editorOpen(filename);
+    }
 
     while (1) {
         editorRefreshScreen();